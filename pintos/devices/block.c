@@ -3,7 +3,22 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/iosched.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/thread.h"
+
+/* Number of buckets in a histogram.  Bucket 0 counts zeros,
+   bucket I counts values in [2**(I-1), 2**I), and the last
+   bucket also counts everything larger. */
+#define HIST_BUCKETS 10
+
+/* Histogram of small nonnegative values, such as latencies in
+   timer ticks or queue depths. */
+struct histogram
+  {
+    unsigned long long cnt[HIST_BUCKETS];
+  };
 
 /* A block device. */
 struct block
@@ -19,6 +34,26 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* Timing of requests submitted to this device, in timer
+       ticks.  For a partition these describe the requests it
+       forwarded, so each role can be told apart even when the
+       roles share a disk. */
+    struct histogram latency[2];        /* Submit to complete, for
+                                           reads [0] and writes [1]. */
+    unsigned long long completed;       /* Requests completed. */
+    int64_t wait_ticks;                 /* Total time queued. */
+    int64_t service_ticks;              /* Total time in the driver. */
+    struct histogram depth;             /* Queue depth seen on submit. */
+    size_t max_depth;                   /* Deepest queue seen on submit. */
+
+    /* Asynchronous request queue. */
+    struct lock queue_lock;             /* Protects the members below. */
+    struct condition queue_nonempty;    /* Signaled when SCHED grows. */
+    struct iosched sched;               /* Pending block_requests. */
+    bool busy;                          /* True while a transfer is in
+                                           the driver. */
+    bool worker_started;                /* True once worker is running. */
   };
 
 /* List of all block devices. */
@@ -28,6 +63,20 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void driver_readv (struct block *, const struct block_iovec *,
+                          size_t iov_cnt);
+static void driver_writev (struct block *, const struct block_iovec *,
+                           size_t iov_cnt);
+static void block_worker (void *block_);
+static void transfer (struct block *, bool write,
+                      const struct block_iovec *, size_t iov_cnt);
+static bool transfer_direct (struct block *, bool write,
+                             const struct block_iovec *);
+static void record_depth (struct block *, size_t depth);
+static void record_completion (struct block *, const struct block_request *,
+                               int64_t now);
+static void hist_add (struct histogram *, uint64_t value);
+static void hist_print (const char *label, const struct histogram *);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +169,8 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  struct block_iovec iov = { sector, 1, buffer };
+  transfer (block, false, &iov, 1);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +181,357 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  struct block_iovec iov = { sector, 1, (void *) buffer };
+  transfer (block, true, &iov, 1);
+}
+
+/* Reads CNT sectors starting at SECTOR from BLOCK into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  struct block_iovec iov = { sector, cnt, buffer };
+  block_readv (block, &iov, 1);
+}
+
+/* Writes CNT sectors starting at SECTOR to BLOCK from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Returns
+   after the block device has acknowledged receiving the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffer)
+{
+  struct block_iovec iov = { sector, cnt, (void *) buffer };
+  block_writev (block, &iov, 1);
+}
+
+/* Verifies that every run in the IOV_CNT elements of IOV lies
+   within BLOCK.  Panics if not. */
+static void
+check_iovec (struct block *block, const struct block_iovec *iov,
+             size_t iov_cnt)
+{
+  size_t i;
+
+  for (i = 0; i < iov_cnt; i++)
+    if (iov[i].cnt > 0)
+      {
+        check_sector (block, iov[i].sector);
+        check_sector (block, iov[i].sector + iov[i].cnt - 1);
+      }
+}
+
+/* Reads each run described by the IOV_CNT elements of IOV from
+   BLOCK into its buffer.  The runs are queued together, so the
+   scheduler may serve them in any order and merge neighbors.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_readv (struct block *block, const struct block_iovec *iov,
+             size_t iov_cnt)
+{
+  transfer (block, false, iov, iov_cnt);
+}
+
+/* Writes each run described by the IOV_CNT elements of IOV to
+   BLOCK from its buffer.  Returns after the block device has
+   acknowledged receiving all the data.  The runs are queued
+   together, so the scheduler may serve them in any order and
+   merge neighbors.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_writev (struct block *block, const struct block_iovec *iov,
+              size_t iov_cnt)
+{
+  transfer (block, true, iov, iov_cnt);
+}
+
+/* Submits one request per nonempty run in the IOV_CNT elements
+   of IOV to BLOCK and waits for all of them.  WRITE selects the
+   direction.  A single run goes straight to the driver if BLOCK
+   is idle.  Falls back to one run at a time if there is no
+   memory for all the requests at once. */
+static void
+transfer (struct block *block, bool write, const struct block_iovec *iov,
+          size_t iov_cnt)
+{
+  struct block_request one;
+  struct block_request *reqs;
+  size_t i;
+
+  ASSERT (!write || block->type != BLOCK_FOREIGN);
+  check_iovec (block, iov, iov_cnt);
+
+  if (iov_cnt == 1 && iov[0].cnt > 0 && transfer_direct (block, write, iov))
+    return;
+
+  reqs = iov_cnt > 1 ? malloc (iov_cnt * sizeof *reqs) : NULL;
+  if (reqs == NULL)
+    {
+      for (i = 0; i < iov_cnt; i++)
+        if (iov[i].cnt > 0)
+          {
+            block_request_init (&one, write, iov[i].sector, iov[i].cnt,
+                                iov[i].buffer, NULL, NULL);
+            block_submit (block, &one);
+            block_wait (&one);
+          }
+      return;
+    }
+
+  for (i = 0; i < iov_cnt; i++)
+    if (iov[i].cnt > 0)
+      {
+        block_request_init (&reqs[i], write, iov[i].sector, iov[i].cnt,
+                            iov[i].buffer, NULL, NULL);
+        block_submit (block, &reqs[i]);
+      }
+  for (i = 0; i < iov_cnt; i++)
+    if (iov[i].cnt > 0)
+      block_wait (&reqs[i]);
+  free (reqs);
+}
+
+/* If BLOCK has no requests queued or in its driver, transfers
+   the run in IOV in the calling thread and returns true, sparing
+   a synchronous transfer the round trip through BLOCK's worker.
+   Otherwise returns false, and the run must be queued, so that
+   the I/O scheduler orders it among the others.  A device that
+   forwards its requests, such as a partition, always transfers
+   directly: its driver calls back into the device it forwards
+   to, which makes the same choice.  WRITE selects the
+   direction. */
+static bool
+transfer_direct (struct block *block, bool write,
+                 const struct block_iovec *iov)
+{
+  bool forwards = block->ops->submit != NULL;
+  struct block_request req;
+
+  if (!forwards)
+    {
+      bool idle;
+
+      lock_acquire (&block->queue_lock);
+      idle = iosched_empty (&block->sched) && !block->busy;
+      if (idle)
+        block->busy = true;
+      lock_release (&block->queue_lock);
+      if (!idle)
+        return false;
+    }
+
+  block_request_init (&req, write, iov->sector, iov->cnt, iov->buffer,
+                      NULL, NULL);
+  req.submit_tick = req.dispatch_tick = timer_ticks ();
+  if (write)
+    {
+      block->write_cnt += iov->cnt;
+      driver_writev (block, iov, 1);
+    }
+  else
+    {
+      block->read_cnt += iov->cnt;
+      driver_readv (block, iov, 1);
+    }
+
+  lock_acquire (&block->queue_lock);
+  record_depth (block, 0);
+  record_completion (block, &req, timer_ticks ());
+  if (!forwards)
+    {
+      block->busy = false;
+      if (!iosched_empty (&block->sched))
+        cond_signal (&block->queue_nonempty, &block->queue_lock);
+    }
+  lock_release (&block->queue_lock);
+  return true;
+}
+
+/* Has BLOCK's driver read the runs in the IOV_CNT elements of
+   IOV, with its scatter-gather read if it has one. */
+static void
+driver_readv (struct block *block, const struct block_iovec *iov,
+              size_t iov_cnt)
+{
+  size_t i, j;
+
+  if (block->ops->readv != NULL)
+    block->ops->readv (block->aux, iov, iov_cnt);
+  else
+    for (i = 0; i < iov_cnt; i++)
+      for (j = 0; j < iov[i].cnt; j++)
+        block->ops->read (block->aux, iov[i].sector + j,
+                          (uint8_t *) iov[i].buffer + j * BLOCK_SECTOR_SIZE);
+}
+
+/* Has BLOCK's driver write the runs in the IOV_CNT elements of
+   IOV, with its scatter-gather write if it has one. */
+static void
+driver_writev (struct block *block, const struct block_iovec *iov,
+               size_t iov_cnt)
+{
+  size_t i, j;
+
+  if (block->ops->writev != NULL)
+    block->ops->writev (block->aux, iov, iov_cnt);
+  else
+    for (i = 0; i < iov_cnt; i++)
+      for (j = 0; j < iov[i].cnt; j++)
+        block->ops->write (block->aux, iov[i].sector + j,
+                           (uint8_t *) iov[i].buffer + j * BLOCK_SECTOR_SIZE);
+}
+
+/* Initializes REQ to transfer CNT sectors starting at SECTOR to
+   or from BUFFER.  WRITE selects the direction.  COMPLETE, which
+   may be null, is called with REQ once the transfer finishes,
+   and may use AUX to find its own data. */
+void
+block_request_init (struct block_request *req, bool write,
+                    block_sector_t sector, size_t cnt, void *buffer,
+                    void (*complete) (struct block_request *), void *aux)
+{
+  req->write = write;
+  req->sector = sector;
+  req->cnt = cnt;
+  req->buffer = buffer;
+  req->complete = complete;
+  req->aux = aux;
+  req->done = false;
+  sema_init (&req->done_sema, 0);
+  req->origin = NULL;
+}
+
+/* Queues REQ on BLOCK and returns without waiting for it.  REQ
+   must stay valid until it completes. */
+void
+block_submit (struct block *block, struct block_request *req)
+{
+  ASSERT (req->cnt > 0);
+  check_sector (block, req->sector);
+  check_sector (block, req->sector + req->cnt - 1);
+  ASSERT (!req->write || block->type != BLOCK_FOREIGN);
+
+  if (req->write)
+    block->write_cnt += req->cnt;
+  else
+    block->read_cnt += req->cnt;
+  if (req->origin == NULL)
+    req->origin = block;
+
+  if (block->ops->submit != NULL)
+    {
+      block->ops->submit (block->aux, req);
+      return;
+    }
+
+  lock_acquire (&block->queue_lock);
+  if (!block->worker_started)
+    {
+      block->worker_started = true;
+      thread_create (block->name, PRI_MAX, block_worker, block);
+    }
+  iosched_add (&block->sched, req);
+  record_depth (block, block->sched.depth);
+  if (req->origin != block)
+    record_depth (req->origin, block->sched.depth);
+  cond_signal (&block->queue_nonempty, &block->queue_lock);
+  lock_release (&block->queue_lock);
+}
+
+/* Waits until REQ, which must not have a completion callback,
+   has finished.  Any number of threads may wait on the same
+   request. */
+void
+block_wait (struct block_request *req)
+{
+  ASSERT (req->complete == NULL);
+  sema_down (&req->done_sema);
+  sema_up (&req->done_sema);
+}
+
+/* Returns true if REQ has finished. */
+bool
+block_request_done (const struct block_request *req)
+{
+  return req->done;
+}
+
+/* Maximum number of adjacent requests the worker hands to the
+   driver as one scatter-gather transfer. */
+#define MAX_BATCH 16
+
+/* Serves BLOCK's request queue forever, in the order chosen by
+   BLOCK's I/O scheduler.  Runs as BLOCK's worker thread, started
+   by the first block_submit() to BLOCK. */
+static void
+block_worker (void *block_)
+{
+  struct block *block = block_;
+
+  for (;;)
+    {
+      struct block_request *batch[MAX_BATCH];
+      struct block_iovec iov[MAX_BATCH];
+      struct block_request *req;
+      int64_t now;
+      size_t cnt, i;
+
+      lock_acquire (&block->queue_lock);
+      while (iosched_empty (&block->sched) || block->busy)
+        cond_wait (&block->queue_nonempty, &block->queue_lock);
+      block->busy = true;
+      batch[0] = iosched_next (&block->sched);
+      for (cnt = 1; cnt < MAX_BATCH; cnt++)
+        {
+          req = iosched_next_adjacent (&block->sched, batch[cnt - 1]);
+          if (req == NULL)
+            break;
+          batch[cnt] = req;
+        }
+      lock_release (&block->queue_lock);
+
+      now = timer_ticks ();
+      for (i = 0; i < cnt; i++)
+        {
+          batch[i]->dispatch_tick = now;
+          iov[i].sector = batch[i]->sector;
+          iov[i].cnt = batch[i]->cnt;
+          iov[i].buffer = batch[i]->buffer;
+        }
+      if (batch[0]->write)
+        driver_writev (block, iov, cnt);
+      else
+        driver_readv (block, iov, cnt);
+
+      now = timer_ticks ();
+      lock_acquire (&block->queue_lock);
+      for (i = 0; i < cnt; i++)
+        {
+          iosched_complete (&block->sched, batch[i]);
+          record_completion (block, batch[i], now);
+          if (batch[i]->origin != block)
+            record_completion (batch[i]->origin, batch[i], now);
+        }
+      block->busy = false;
+      lock_release (&block->queue_lock);
+
+      for (i = 0; i < cnt; i++)
+        {
+          req = batch[i];
+          req->done = true;
+          if (req->complete != NULL)
+            req->complete (req);
+          else
+            sema_up (&req->done_sema);
+        }
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,22 +555,63 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Returns true if BLOCK has been assigned a Pintos role. */
+static bool
+has_role (const struct block *block)
+{
+  int i;
+
+  for (i = 0; i < BLOCK_ROLE_CNT; i++)
+    if (block_by_role[i] == block)
+      return true;
+  return false;
+}
+
+/* Prints BLOCK's transfer counts and request timing. */
+static void
+print_block_stats (const struct block *block)
+{
+  printf ("%s (%s): %llu reads, %llu writes\n",
+          block->name, block_type_name (block->type),
+          block->read_cnt, block->write_cnt);
+  if (block->completed == 0)
+    return;
+
+  printf ("  %llu requests, %"PRId64" ticks average wait, "
+          "%"PRId64" ticks average service, queue depth up to %zu\n",
+          block->completed,
+          block->wait_ticks / (int64_t) block->completed,
+          block->service_ticks / (int64_t) block->completed,
+          block->max_depth);
+  hist_print ("read latency", &block->latency[0]);
+  hist_print ("write latency", &block->latency[1]);
+  hist_print ("queue depth", &block->depth);
+}
+
+/* Prints statistics for each block device used for a Pintos
+   role, then for each device that served queued requests on
+   behalf of those roles. */
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
     {
       struct block *block = block_by_role[i];
       if (block != NULL)
-        {
-          printf ("%s (%s): %llu reads, %llu writes\n",
-                  block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
-        }
+        print_block_stats (block);
+    }
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      if (block->worker_started && !has_role (block))
+        print_block_stats (block);
     }
+  iosched_print_stats ();
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -200,6 +636,17 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  memset (block->latency, 0, sizeof block->latency);
+  block->completed = 0;
+  block->wait_ticks = 0;
+  block->service_ticks = 0;
+  memset (&block->depth, 0, sizeof block->depth);
+  block->max_depth = 0;
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_nonempty);
+  iosched_init (&block->sched);
+  block->busy = false;
+  block->worker_started = false;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -221,3 +668,68 @@ list_elem_to_block (struct list_elem *list_elem)
           : NULL);
 }
 
+
+/* Records in BLOCK that a submitted request found DEPTH requests
+   queued, counting itself. */
+static void
+record_depth (struct block *block, size_t depth)
+{
+  hist_add (&block->depth, depth);
+  if (depth > block->max_depth)
+    block->max_depth = depth;
+}
+
+/* Records in BLOCK that REQ completed at timer tick NOW. */
+static void
+record_completion (struct block *block, const struct block_request *req,
+                   int64_t now)
+{
+  hist_add (&block->latency[req->write], now - req->submit_tick);
+  block->completed++;
+  block->wait_ticks += req->dispatch_tick - req->submit_tick;
+  block->service_ticks += now - req->dispatch_tick;
+}
+
+/* Counts VALUE in histogram H. */
+static void
+hist_add (struct histogram *h, uint64_t value)
+{
+  int bucket = 0;
+
+  while (value > 0 && bucket < HIST_BUCKETS - 1)
+    {
+      value >>= 1;
+      bucket++;
+    }
+  h->cnt[bucket]++;
+}
+
+/* Prints the nonempty buckets of H on one line headed by LABEL,
+   or nothing if H is empty. */
+static void
+hist_print (const char *label, const struct histogram *h)
+{
+  bool empty = true;
+  int i;
+
+  for (i = 0; i < HIST_BUCKETS; i++)
+    {
+      unsigned long long lo = i == 0 ? 0 : 1ULL << (i - 1);
+      unsigned long long hi = i == 0 ? 0 : (1ULL << i) - 1;
+
+      if (h->cnt[i] == 0)
+        continue;
+      if (empty)
+        printf ("  %s:", label);
+      empty = false;
+
+      if (i == HIST_BUCKETS - 1)
+        printf (" %llu+:%llu", lo, h->cnt[i]);
+      else if (lo == hi)
+        printf (" %llu:%llu", lo, h->cnt[i]);
+      else
+        printf (" %llu-%llu:%llu", lo, hi, h->cnt[i]);
+    }
+  if (!empty)
+    printf ("\n");
+}
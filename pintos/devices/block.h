@@ -1,8 +1,11 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -22,6 +25,17 @@ typedef uint32_t block_sector_t;
 
 struct block;
 
+/* A run of CNT consecutive sectors starting at SECTOR, and the
+   buffer of CNT * BLOCK_SECTOR_SIZE bytes that they are read
+   into or written from.  An array of these describes one
+   scatter-gather transfer. */
+struct block_iovec
+  {
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* Data. */
+  };
+
 /* Type of a block device. */
 enum block_type
   {
@@ -53,9 +67,58 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt, void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
+void block_readv (struct block *, const struct block_iovec *, size_t iov_cnt);
+void block_writev (struct block *, const struct block_iovec *,
+                   size_t iov_cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous I/O.
+
+   A request transfers CNT consecutive sectors starting at SECTOR
+   to or from BUFFER.  block_submit() queues it and returns at
+   once.  Each block device has one worker thread that serves its
+   queue in the order chosen by its I/O scheduler (see iosched.h),
+   so a caller never waits on the disk unless it asks to with
+   block_wait().  The synchronous calls above are built on the
+   same queue.
+
+   If COMPLETE is non-null, the worker calls it when the transfer
+   finishes, after which COMPLETE owns the request and may free
+   it.  COMPLETE runs in the worker thread, so it must not wait on
+   anything that might itself be waiting on block I/O.  Requests
+   with a COMPLETE function may not be passed to block_wait().
+   Submitting to a partition translates SECTOR to the underlying
+   device, so SECTOR should not be relied on afterward. */
+struct block_request
+  {
+    struct list_elem elem;      /* Element in queue, by sector. */
+    struct list_elem fifo_elem; /* Element in queue, by arrival. */
+    bool write;                 /* True to write, false to read. */
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    void (*complete) (struct block_request *);  /* Completion callback. */
+    void *aux;                  /* For use by COMPLETE. */
+    bool done;                  /* True once the transfer finished. */
+    struct semaphore done_sema; /* Up'd when done, if no COMPLETE. */
+    int64_t submit_tick;        /* Timer tick when queued. */
+    int64_t deadline;           /* Tick by which it should be served. */
+    int64_t dispatch_tick;      /* Timer tick when handed to driver. */
+    struct block *origin;       /* Device it was first submitted to. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, size_t cnt, void *buffer,
+                         void (*complete) (struct block_request *),
+                         void *aux);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+bool block_request_done (const struct block_request *);
+
 /* Statistics. */
 void block_print_stats (void);
 
@@ -65,6 +128,18 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer every run in an array of IOV_CNT
+       block_iovecs, in as few device commands as the driver can
+       manage.  If null, the block layer falls back to one read or
+       write per sector. */
+    void (*readv) (void *aux, const struct block_iovec *, size_t iov_cnt);
+    void (*writev) (void *aux, const struct block_iovec *, size_t iov_cnt);
+
+    /* Optional.  Passes an asynchronous request on to another
+       block device, adjusting its sector as needed.  If null,
+       requests are queued for this device's own worker thread. */
+    void (*submit) (void *aux, struct block_request *);
   };
 
 struct block *block_register (const char *name, enum block_type,
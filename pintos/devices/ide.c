@@ -34,6 +34,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +50,13 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+
+/* Most sectors a single command can transfer.  A sector count
+   register value of 0 means 256. */
+#define MAX_XFER_SECTORS 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +65,8 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt for READ/WRITE
+                                   MULTIPLE, or 0 if not enabled. */
   };
 
 /* An ATA channel (aka controller).
@@ -86,9 +96,11 @@ static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
 static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
+static void set_multiple_mode (struct ata_disk *, int multiple);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -136,6 +148,7 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
         }
 
       /* Register interrupt handler. */
@@ -289,6 +302,11 @@ identify_ata_device (struct ata_disk *d)
   snprintf (extra_info, sizeof extra_info,
             "model \"%s\", serial \"%s\"", model, serial);
 
+  /* Word 47 holds the most sectors the disk can move per
+     interrupt with READ/WRITE MULTIPLE, or 0 if unsupported. */
+  if (id[47 * 2] != 0)
+    set_multiple_mode (d, (uint8_t) id[47 * 2]);
+
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
      allow access to those, we're less likely to scribble on
@@ -376,24 +394,202 @@ ide_write (void *d_, block_sector_t sec_no, const void *buffer)
   lock_release (&c->lock);
 }
 
+/* Walks the sectors of a scatter-gather transfer in order. */
+struct iov_cursor
+  {
+    const struct block_iovec *iov;      /* Current run. */
+    size_t iov_cnt;                     /* Runs left, including IOV. */
+    size_t ofs;                         /* Sectors done within IOV. */
+  };
+
+/* Skips runs that CURSOR has finished.  Returns false once there
+   are no sectors left. */
+static bool
+iov_cursor_valid (struct iov_cursor *cursor)
+{
+  while (cursor->iov_cnt > 0 && cursor->ofs == cursor->iov->cnt)
+    {
+      cursor->iov++;
+      cursor->iov_cnt--;
+      cursor->ofs = 0;
+    }
+  return cursor->iov_cnt > 0;
+}
+
+/* Returns the next sector of CURSOR's transfer. */
+static block_sector_t
+iov_cursor_sector (const struct iov_cursor *cursor)
+{
+  return cursor->iov->sector + cursor->ofs;
+}
+
+/* Returns the buffer for the next sector of CURSOR's transfer,
+   and advances CURSOR past it. */
+static uint8_t *
+iov_cursor_next (struct iov_cursor *cursor)
+{
+  uint8_t *buffer = cursor->iov->buffer;
+  return buffer + cursor->ofs++ * BLOCK_SECTOR_SIZE;
+}
+
+/* Returns how many sectors, up to MAX_XFER_SECTORS, one command
+   can move starting at CURSOR.  A command may span several runs,
+   as long as each run starts where the previous one ended. */
+static size_t
+iov_cursor_run_length (const struct iov_cursor *cursor)
+{
+  const struct block_iovec *iov = cursor->iov;
+  size_t cnt = iov->cnt - cursor->ofs;
+  size_t i;
+
+  for (i = 1; i < cursor->iov_cnt && cnt < MAX_XFER_SECTORS; i++)
+    {
+      if (iov[i].sector != iov[i - 1].sector + iov[i - 1].cnt)
+        break;
+      cnt += iov[i].cnt;
+    }
+  return cnt < MAX_XFER_SECTORS ? cnt : MAX_XFER_SECTORS;
+}
+
+/* Returns the number of sectors D transfers per interrupt with
+   COMMAND. */
+static size_t
+sectors_per_interrupt (const struct ata_disk *d, uint8_t command)
+{
+  return (command == CMD_READ_MULTIPLE || command == CMD_WRITE_MULTIPLE
+          ? (size_t) d->multiple : 1);
+}
+
+/* Reads each run in the IOV_CNT elements of IOV from disk D.
+   Runs whose sectors follow on from each other share a command
+   of up to MAX_XFER_SECTORS sectors, which interrupts once per
+   sector, or once per D->multiple sectors if READ MULTIPLE is
+   enabled.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_readv (void *d_, const struct block_iovec *iov, size_t iov_cnt)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  struct iov_cursor cursor = { iov, iov_cnt, 0 };
+  uint8_t command = d->multiple > 0 ? CMD_READ_MULTIPLE
+                                    : CMD_READ_SECTOR_RETRY;
+  lock_acquire (&c->lock);
+  while (iov_cursor_valid (&cursor))
+    {
+      block_sector_t sec_no = iov_cursor_sector (&cursor);
+      size_t xfer_cnt = iov_cursor_run_length (&cursor);
+      size_t i;
+
+      select_sectors (d, sec_no, xfer_cnt);
+      issue_pio_command (c, command);
+      for (i = 0; i < xfer_cnt; i++)
+        {
+          if (i % sectors_per_interrupt (d, command) == 0)
+            {
+              sema_down (&c->completion_wait);
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                       d->name, sec_no + i);
+            }
+          iov_cursor_valid (&cursor);
+          input_sector (c, iov_cursor_next (&cursor));
+        }
+    }
+  lock_release (&c->lock);
+}
+
+/* Writes each run in the IOV_CNT elements of IOV to disk D.
+   Returns after the disk has acknowledged receiving all the
+   data.  Batches sectors into commands like ide_readv().
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_writev (void *d_, const struct block_iovec *iov, size_t iov_cnt)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  struct iov_cursor cursor = { iov, iov_cnt, 0 };
+  uint8_t command = d->multiple > 0 ? CMD_WRITE_MULTIPLE
+                                    : CMD_WRITE_SECTOR_RETRY;
+  lock_acquire (&c->lock);
+  while (iov_cursor_valid (&cursor))
+    {
+      block_sector_t sec_no = iov_cursor_sector (&cursor);
+      size_t xfer_cnt = iov_cursor_run_length (&cursor);
+      size_t i;
+
+      select_sectors (d, sec_no, xfer_cnt);
+      issue_pio_command (c, command);
+      for (i = 0; i < xfer_cnt; i++)
+        {
+          /* The disk asks for the first block right away, and
+             interrupts once it has taken each block. */
+          if (i % sectors_per_interrupt (d, command) == 0)
+            {
+              if (i > 0)
+                sema_down (&c->completion_wait);
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                       d->name, sec_no + i);
+            }
+          iov_cursor_valid (&cursor);
+          output_sector (c, iov_cursor_next (&cursor));
+        }
+      sema_down (&c->completion_wait);
+    }
+  lock_release (&c->lock);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_readv,
+    ide_writev,
+    NULL
   };
+
+/* Enables READ/WRITE MULTIPLE on disk D with MULTIPLE sectors
+   per interrupt.  Leaves D->multiple at 0 if the disk rejects
+   the setting. */
+static void
+set_multiple_mode (struct ata_disk *d, int multiple)
+{
+  struct channel *c = d->channel;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), multiple);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_alt_status (c)) & STA_ERR) == 0)
+    d->multiple = multiple;
+}
 
 /* Selects device D, waiting for it to become ready, and then
    writes SEC_NO to the disk's sector selection registers.  (We
    use LBA mode.) */
 static void
 select_sector (struct ata_disk *d, block_sector_t sec_no)
+{
+  select_sectors (d, sec_no, 1);
+}
+
+/* Like select_sector(), but selects CNT sectors starting at
+   SEC_NO for a multi-sector command.  CNT must be between 1 and
+   MAX_XFER_SECTORS. */
+static void
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_XFER_SECTORS);
+  ASSERT (sec_no + cnt <= (1UL << 28));
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_XFER_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -0,0 +1,239 @@
+#include "devices/iosched.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+
+/* Ticks a read or a write may wait under the deadline policy
+   before it is served ahead of the sweep. */
+#define READ_EXPIRE_TICKS 10
+#define WRITE_EXPIRE_TICKS 50
+
+/* An ordering policy. */
+struct iosched_policy
+  {
+    const char *name;           /* Name for -iosched. */
+
+    /* Returns the queued request to serve next, without
+       removing it.  The queue is not empty. */
+    struct block_request *(*choose) (const struct iosched *);
+  };
+
+/* Latency, from submission to completion, of the requests served
+   under one policy. */
+struct iosched_stats
+  {
+    unsigned long long cnt;     /* Requests completed. */
+    int64_t total_ticks;        /* Sum of latencies. */
+    int64_t max_ticks;          /* Longest latency. */
+  };
+
+static struct block_request *fifo_choose (const struct iosched *);
+static struct block_request *cscan_choose (const struct iosched *);
+static struct block_request *deadline_choose (const struct iosched *);
+
+static const struct iosched_policy policies[] =
+  {
+    {"fifo", fifo_choose},
+    {"cscan", cscan_choose},
+    {"deadline", deadline_choose},
+  };
+#define POLICY_CNT (sizeof policies / sizeof *policies)
+
+static struct iosched_stats stats[POLICY_CNT];
+
+/* Policy given to newly initialized schedulers.  Arrival order,
+   as block devices served requests before there was a choice. */
+static const struct iosched_policy *default_policy = &policies[0];
+
+static bool sector_less (const struct list_elem *, const struct list_elem *,
+                         void *aux);
+static void remove_request (struct iosched *, struct block_request *);
+
+/* Makes NAME the policy for every block device.  Must be called
+   before any device is used.  Returns false if there is no
+   policy named NAME. */
+bool
+iosched_select (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < POLICY_CNT; i++)
+    if (!strcmp (name, policies[i].name))
+      {
+        default_policy = &policies[i];
+        return true;
+      }
+  return false;
+}
+
+/* Initializes S as an empty queue using the selected policy. */
+void
+iosched_init (struct iosched *s)
+{
+  s->policy = default_policy;
+  list_init (&s->sorted);
+  list_init (&s->fifo);
+  s->head = 0;
+  s->depth = 0;
+}
+
+/* Returns true if S has no queued requests. */
+bool
+iosched_empty (const struct iosched *s)
+{
+  return s->depth == 0;
+}
+
+/* Queues REQ in S. */
+void
+iosched_add (struct iosched *s, struct block_request *req)
+{
+  req->submit_tick = timer_ticks ();
+  req->deadline = req->submit_tick + (req->write ? WRITE_EXPIRE_TICKS
+                                                 : READ_EXPIRE_TICKS);
+  list_insert_ordered (&s->sorted, &req->elem, sector_less, NULL);
+  list_push_back (&s->fifo, &req->fifo_elem);
+  s->depth++;
+}
+
+/* Removes and returns the request S's policy serves next, or a
+   null pointer if S is empty. */
+struct block_request *
+iosched_next (struct iosched *s)
+{
+  struct block_request *req;
+
+  if (iosched_empty (s))
+    return NULL;
+  req = s->policy->choose (s);
+  remove_request (s, req);
+  return req;
+}
+
+/* Removes and returns a queued request in S that continues where
+   PREV ends, in the same direction, so that the two can go to
+   the device as one transfer.  Returns a null pointer if there
+   is none. */
+struct block_request *
+iosched_next_adjacent (struct iosched *s, const struct block_request *prev)
+{
+  block_sector_t sector = prev->sector + prev->cnt;
+  struct list_elem *e;
+
+  for (e = list_begin (&s->sorted); e != list_end (&s->sorted);
+       e = list_next (e))
+    {
+      struct block_request *req = list_entry (e, struct block_request, elem);
+      if (req->sector > sector)
+        break;
+      if (req->sector == sector && req->write == prev->write)
+        {
+          remove_request (s, req);
+          return req;
+        }
+    }
+  return NULL;
+}
+
+/* Records that REQ, taken from S, has finished.  The statistics
+   are shared by every device that uses S's policy, so they are
+   updated with interrupts off: each device's queue lock covers
+   only that device. */
+void
+iosched_complete (struct iosched *s, struct block_request *req)
+{
+  struct iosched_stats *st = &stats[s->policy - policies];
+  int64_t latency = timer_ticks () - req->submit_tick;
+  enum intr_level old_level = intr_disable ();
+
+  st->cnt++;
+  st->total_ticks += latency;
+  if (latency > st->max_ticks)
+    st->max_ticks = latency;
+  intr_set_level (old_level);
+}
+
+/* Prints request latency for each policy that served requests. */
+void
+iosched_print_stats (void)
+{
+  size_t i;
+
+  for (i = 0; i < POLICY_CNT; i++)
+    if (stats[i].cnt > 0)
+      printf ("I/O scheduler %s: %llu requests, "
+              "%"PRId64" ticks average latency, %"PRId64" ticks max\n",
+              policies[i].name, stats[i].cnt,
+              stats[i].total_ticks / (int64_t) stats[i].cnt,
+              stats[i].max_ticks);
+}
+
+/* Serves requests in arrival order. */
+static struct block_request *
+fifo_choose (const struct iosched *s)
+{
+  return list_entry (list_front ((struct list *) &s->fifo),
+                     struct block_request, fifo_elem);
+}
+
+/* Serves the lowest sector at or after the head, or else the
+   lowest sector overall, so the head sweeps in one direction. */
+static struct block_request *
+cscan_choose (const struct iosched *s)
+{
+  struct list *sorted = (struct list *) &s->sorted;
+  struct list_elem *e;
+
+  for (e = list_begin (sorted); e != list_end (sorted); e = list_next (e))
+    {
+      struct block_request *req = list_entry (e, struct block_request, elem);
+      if (req->sector >= s->head)
+        return req;
+    }
+  return list_entry (list_front (sorted), struct block_request, elem);
+}
+
+/* Serves the request with the earliest deadline if that deadline
+   has passed, otherwise follows C-SCAN. */
+static struct block_request *
+deadline_choose (const struct iosched *s)
+{
+  struct list *fifo = (struct list *) &s->fifo;
+  struct block_request *earliest = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (fifo); e != list_end (fifo); e = list_next (e))
+    {
+      struct block_request *req = list_entry (e, struct block_request,
+                                              fifo_elem);
+      if (earliest == NULL || req->deadline < earliest->deadline)
+        earliest = req;
+    }
+
+  if (earliest->deadline <= timer_ticks ())
+    return earliest;
+  return cscan_choose (s);
+}
+
+/* Orders block_requests by ascending sector. */
+static bool
+sector_less (const struct list_elem *a_, const struct list_elem *b_,
+             void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+  return a->sector < b->sector;
+}
+
+/* Takes REQ out of S and moves S's head past it. */
+static void
+remove_request (struct iosched *s, struct block_request *req)
+{
+  list_remove (&req->elem);
+  list_remove (&req->fifo_elem);
+  s->depth--;
+  s->head = req->sector + req->cnt;
+}
@@ -0,0 +1,48 @@
+#ifndef DEVICES_IOSCHED_H
+#define DEVICES_IOSCHED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <list.h>
+#include "devices/block.h"
+
+/* I/O scheduler.
+
+   Sits between a block device's request queue and its driver,
+   and decides which queued request the device serves next.  The
+   policy is chosen once, at boot, with the -iosched option:
+
+     fifo      Arrival order.  The default.
+     cscan     C-SCAN: sweep upward from the head, then jump back
+               to the lowest queued sector.
+     deadline  C-SCAN, except that a request waiting past its
+               deadline is served first.  Reads expire sooner
+               than writes, since a thread is usually blocked on
+               a read. */
+
+struct iosched_policy;
+
+/* Requests queued for one block device. */
+struct iosched
+  {
+    const struct iosched_policy *policy;  /* Ordering policy. */
+    struct list sorted;         /* Queued requests, ascending sector. */
+    struct list fifo;           /* Queued requests, arrival order. */
+    block_sector_t head;        /* Sector after the last one served. */
+    size_t depth;               /* Number of queued requests. */
+  };
+
+bool iosched_select (const char *name);
+
+void iosched_init (struct iosched *);
+bool iosched_empty (const struct iosched *);
+void iosched_add (struct iosched *, struct block_request *);
+struct block_request *iosched_next (struct iosched *);
+struct block_request *iosched_next_adjacent (struct iosched *,
+                                             const struct block_request *);
+void iosched_complete (struct iosched *, struct block_request *);
+
+void iosched_print_stats (void);
+
+#endif /* devices/iosched.h */
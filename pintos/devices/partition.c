@@ -13,6 +13,10 @@ struct partition
     block_sector_t start;               /* First sector within device. */
   };
 
+/* Most scatter-gather runs forwarded to the underlying block
+   device in one call. */
+#define PARTITION_IOV_BATCH 16
+
 static struct block_operations partition_operations;
 
 static void read_partition_table (struct block *, block_sector_t sector,
@@ -317,8 +321,75 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/* Copies up to PARTITION_IOV_BATCH elements of the IOV_CNT in
+   IOV into SHIFTED, translated from partition P's sectors to its
+   block device's sectors.  Returns the number copied. */
+static size_t
+shift_iovec (const struct partition *p, const struct block_iovec *iov,
+             size_t iov_cnt, struct block_iovec shifted[])
+{
+  size_t i;
+
+  if (iov_cnt > PARTITION_IOV_BATCH)
+    iov_cnt = PARTITION_IOV_BATCH;
+  for (i = 0; i < iov_cnt; i++)
+    {
+      shifted[i] = iov[i];
+      shifted[i].sector += p->start;
+    }
+  return iov_cnt;
+}
+
+/* Reads each run in the IOV_CNT elements of IOV from partition
+   P. */
+static void
+partition_readv (void *p_, const struct block_iovec *iov, size_t iov_cnt)
+{
+  struct partition *p = p_;
+  struct block_iovec shifted[PARTITION_IOV_BATCH];
+
+  while (iov_cnt > 0)
+    {
+      size_t cnt = shift_iovec (p, iov, iov_cnt, shifted);
+      block_readv (p->block, shifted, cnt);
+      iov += cnt;
+      iov_cnt -= cnt;
+    }
+}
+
+/* Writes each run in the IOV_CNT elements of IOV to partition
+   P.  Returns after the block has acknowledged receiving the
+   data. */
+static void
+partition_writev (void *p_, const struct block_iovec *iov, size_t iov_cnt)
+{
+  struct partition *p = p_;
+  struct block_iovec shifted[PARTITION_IOV_BATCH];
+
+  while (iov_cnt > 0)
+    {
+      size_t cnt = shift_iovec (p, iov, iov_cnt, shifted);
+      block_writev (p->block, shifted, cnt);
+      iov += cnt;
+      iov_cnt -= cnt;
+    }
+}
+
+/* Passes asynchronous request REQ on to partition P's block
+   device. */
+static void
+partition_submit (void *p_, struct block_request *req)
+{
+  struct partition *p = p_;
+  req->sector += p->start;
+  block_submit (p->block, req);
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    partition_readv,
+    partition_writev,
+    partition_submit
   };
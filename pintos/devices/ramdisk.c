@@ -0,0 +1,86 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device whose sectors live in kernel memory.
+
+   The disk is built from individual kernel pages rather than
+   one contiguous allocation, so it can be as large as the kernel
+   pool allows.  Its contents do not survive a reboot, so a file
+   system on it must be formatted with -f each boot.  It is
+   registered as a raw device named "ram0" and is given a role
+   only by name, e.g. -swap=ram0. */
+
+/* Sectors per page of backing memory. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Backing pages, one per SECTORS_PER_PAGE sectors. */
+static uint8_t **pages;
+
+static void ramdisk_read (void *aux, block_sector_t, void *);
+static void ramdisk_write (void *aux, block_sector_t, const void *);
+
+static const struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    NULL,
+    NULL,
+    NULL,
+  };
+
+/* Creates and registers a RAM disk of KB kilobytes, rounded up to
+   a whole number of pages.  Panics if there is not enough kernel
+   memory. */
+void
+ramdisk_init (size_t kb)
+{
+  size_t page_cnt = DIV_ROUND_UP (kb * 1024, PGSIZE);
+  size_t i;
+
+  ASSERT (page_cnt > 0);
+
+  pages = malloc (page_cnt * sizeof *pages);
+  if (pages == NULL)
+    PANIC ("ram0: out of memory for page table");
+  for (i = 0; i < page_cnt; i++)
+    {
+      pages[i] = palloc_get_page (PAL_ZERO);
+      if (pages[i] == NULL)
+        PANIC ("ram0: out of kernel memory after %zu of %zu pages",
+               i, page_cnt);
+    }
+
+  block_register ("ram0", BLOCK_RAW, "RAM disk",
+                  page_cnt * SECTORS_PER_PAGE, &ramdisk_operations, NULL);
+}
+
+/* Returns the address of SECTOR's data. */
+static uint8_t *
+sector_address (block_sector_t sector)
+{
+  return (pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads sector SEC_NO into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes.  The block layer checks SEC_NO and
+   serializes access through the device's queue. */
+static void
+ramdisk_read (void *aux UNUSED, block_sector_t sec_no, void *buffer)
+{
+  memcpy (buffer, sector_address (sec_no), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes sector SEC_NO from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_write (void *aux UNUSED, block_sector_t sec_no, const void *buffer)
+{
+  memcpy (sector_address (sec_no), buffer, BLOCK_SECTOR_SIZE);
+}
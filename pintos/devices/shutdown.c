@@ -13,6 +13,9 @@
 #include "devices/block.h"
 #include "filesys/filesys.h"
 #endif
+#ifdef VM
+#include "vm/zswap.h"
+#endif
 
 /* Keyboard control register port. */
 #define CONTROL_REG 0x64
@@ -124,6 +127,9 @@ print_stats (void)
 #ifdef FILESYS
   block_print_stats ();
   cache_print_stats ();
+#endif
+#ifdef VM
+  zswap_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
@@ -1,5 +1,6 @@
 #include "filesys/cache.h"
 #include "devices/timer.h"
+#include "filesys/free-map.h"
 #include "lib/kernel/list.h"
 #include "lib/stdio.h"
 #include "lib/string.h"
@@ -13,16 +14,17 @@
 /* How many ticks in between flushing cache to disk. */
 #define DISK_WRITE_FREQUENCY 10
 
-/* Max number of asynchronous async read-ahead threads. */
-#define MAX_READ_AHEAD_THREADS 10
+/* Max number of read-ahead requests in flight. */
+#define MAX_READ_AHEAD_REQUESTS 10
 
 static bool cache_entry_exists (block_sector_t sector);
 static struct cache_entry * get_cache_entry (block_sector_t sector);
 static void read_cache_entry_from_disk (struct cache_entry *cache_entry);
 static void write_cache_entry_to_disk (struct cache_entry *cache_entry);
 static void write_cache_to_disk_thread (void *aux);
-static void cache_read_thread (void *sector);
 static struct cache_entry * get_cache_entry_to_evict (void);
+static bool cache_entry_busy (const struct cache_entry *cache_entry);
+static unsigned read_ahead_in_flight (void);
 
 static unsigned cache_reads = 0;
 static unsigned cache_writes = 0;
@@ -35,6 +37,8 @@ struct cache_entry
   bool free;
   bool dirty;
   int64_t last_accessed_tick;
+  bool reading;                   /* True if REQUEST was a read-ahead. */
+  struct block_request request;   /* Read-ahead into data. */
   uint8_t data[BLOCK_SECTOR_SIZE];
 };
 
@@ -42,7 +46,6 @@ struct cache_entry cache[CACHE_NUM_SECTORS];
 
 struct lock cache_lock;
 
-static unsigned read_ahead_threads = 0;
 
 /* Init the buffer cache. */
 void
@@ -83,17 +86,44 @@ cache_read_partial (block_sector_t sector, void *buffer, int sector_ofs, int siz
   ++cache_reads;
 }
 
-/* Read a sector into cache asynchronously. */
+/* Read a sector into cache asynchronously. The read is queued on the block
+ * device, so no thread waits for it until someone accesses the sector. Only
+ * uses a free or clean cache entry, so read-ahead never waits on a write. */
 void cache_read_async (block_sector_t sector)
 {
-  block_sector_t *sector_ptr = malloc (sizeof (block_sector_t));
-  if (sector_ptr && read_ahead_threads < MAX_READ_AHEAD_THREADS &&
-      !cache_entry_exists (sector))
+  lock_acquire (&cache_lock);
+  if (read_ahead_in_flight () >= MAX_READ_AHEAD_REQUESTS ||
+      cache_entry_exists (sector))
+  {
+    lock_release (&cache_lock);
+    return;
+  }
+
+  struct cache_entry *cache_entry = NULL;
+  for (int i = 0; i < CACHE_NUM_SECTORS && !cache_entry; ++i)
+  {
+    if (cache[i].free)
+      cache_entry = cache + i;
+  }
+  if (!cache_entry)
+  {
+    cache_entry = get_cache_entry_to_evict ();
+    if (cache_entry && cache_entry->dirty)
+      cache_entry = NULL;
+  }
+
+  if (cache_entry)
   {
-    *sector_ptr = sector;
-    ++read_ahead_threads;
-    thread_create ("cache_read_async", PRI_DEFAULT, cache_read_thread, sector_ptr);
+    cache_entry->sector = sector;
+    cache_entry->free = false;
+    cache_entry->dirty = false;
+    cache_entry->last_accessed_tick = timer_ticks ();
+    cache_entry->reading = true;
+    block_request_init (&cache_entry->request, false, sector, 1,
+        cache_entry->data, NULL, NULL);
+    block_submit (fs_device, &cache_entry->request);
   }
+  lock_release (&cache_lock);
 }
 
 /* Read entire sector into buffer. */
@@ -157,6 +187,10 @@ get_cache_entry (block_sector_t sector)
     if (cache_entry->sector == sector && !cache_entry->free)
     {
       lock_release (&cache_lock);
+
+      /* Wait for a read-ahead of this sector to land. */
+      if (cache_entry->reading)
+        block_wait (&cache_entry->request);
       return cache_entry;
     }
 
@@ -179,6 +213,7 @@ get_cache_entry (block_sector_t sector)
   else
   {
     cache_entry = get_cache_entry_to_evict ();
+    ASSERT (cache_entry != NULL);
     write_cache_entry_to_disk (cache_entry);
     cache_entry->sector = sector;
     read_cache_entry_from_disk (cache_entry);
@@ -194,32 +229,61 @@ read_cache_entry_from_disk (struct cache_entry *cache_entry)
 {
   block_read (fs_device, cache_entry->sector, cache_entry->data);
   cache_entry->dirty = false;
+  cache_entry->reading = false;
 }
 
-/* Write contents from cache_entry into disk if cache_entry is dirty. */
+/* Write contents from cache_entry into disk if cache_entry is dirty.
+ * The free map is flushed first, so that sectors allocated for this entry's
+ * metadata are marked used on disk before anything points to them. */
 static void
 write_cache_entry_to_disk (struct cache_entry *cache_entry)
 {
   if (cache_entry->dirty)
   {
+    free_map_flush ();
     block_write (fs_device, cache_entry->sector, cache_entry->data);
     cache_entry->dirty = false;
   }
 }
 
 /* Writes the entire cache to disk. Should only be called periodically from
- * write_cache_to_disk_thread and on system shutdown. */
+ * write_cache_to_disk_thread and on system shutdown.
+ * Dirty entries are sorted by sector and submitted as one scatter-gather
+ * write, so the driver can merge neighbouring sectors into one command. */
 void
 write_cache_to_disk (void)
 {
+  static struct block_iovec iov[CACHE_NUM_SECTORS];
+  size_t iov_cnt = 0;
+
   lock_acquire (&cache_lock);
-  struct cache_entry *cache_entry;
+  free_map_writeback_begin ();
   for (int i = 0; i < CACHE_NUM_SECTORS; ++i)
   {
-    cache_entry = cache + i;
-    if (!cache_entry->free)
-      write_cache_entry_to_disk (cache_entry);
+    struct cache_entry *cache_entry = cache + i;
+    if (cache_entry->free || !cache_entry->dirty)
+      continue;
+
+    /* Insertion sort by sector. */
+    size_t j = iov_cnt++;
+    for (; j > 0 && iov[j - 1].sector > cache_entry->sector; --j)
+      iov[j] = iov[j - 1];
+    iov[j].sector = cache_entry->sector;
+    iov[j].cnt = 1;
+    iov[j].buffer = cache_entry->data;
+    cache_entry->dirty = false;
+  }
+
+  if (iov_cnt > 0)
+  {
+    free_map_flush ();
+    block_writev (fs_device, iov, iov_cnt);
   }
+
+  /* Sectors released before this write-back are no longer referenced on
+   * disk, so they can be freed and the free map persisted. */
+  free_map_writeback_end ();
+  free_map_flush ();
   lock_release (&cache_lock);
 }
 
@@ -237,28 +301,44 @@ write_cache_to_disk_thread (void *aux UNUSED)
   }
 }
 
-/* Read sector from disk into cache. This function should be called as a
- * thread with thread_create. */
-static void
-cache_read_thread (void *sector)
+/* Returns whether cache_entry is waiting on a read-ahead. Must hold
+ * cache_lock. */
+static bool
+cache_entry_busy (const struct cache_entry *cache_entry)
+{
+  return cache_entry->reading && !block_request_done (&cache_entry->request);
+}
+
+/* Returns the number of read-ahead requests still in flight. Must hold
+ * cache_lock. */
+static unsigned
+read_ahead_in_flight (void)
 {
-  get_cache_entry (*(block_sector_t *) sector);
-  free (sector);
-  --read_ahead_threads;
+  unsigned cnt = 0;
+  for (int i = 0; i < CACHE_NUM_SECTORS; ++i)
+  {
+    if (!cache[i].free && cache_entry_busy (cache + i))
+      ++cnt;
+  }
+  return cnt;
 }
 
 /* Get the cache_entry to evict. Evicts the least recently used cache entry
  * as indicated by the timer tick it was last accessed. Assumes there are
- * no free cache entries. 
+ * no free cache entries. Skips entries with a read-ahead in flight, and
+ * returns NULL if every entry has one.
  * This basic LRU performs equally to random eviction. Could explore other
  * options. */
 static struct cache_entry *
 get_cache_entry_to_evict (void)
 {
-  struct cache_entry *cache_entry = cache;
-  for (int i = 1; i < CACHE_NUM_SECTORS; ++i)
+  struct cache_entry *cache_entry = NULL;
+  for (int i = 0; i < CACHE_NUM_SECTORS; ++i)
   {
-    if (cache[i].last_accessed_tick < cache_entry->last_accessed_tick)
+    if (cache_entry_busy (cache + i))
+      continue;
+    if (!cache_entry
+        || cache[i].last_accessed_tick < cache_entry->last_accessed_tick)
       cache_entry = cache + i;
   }
   return cache_entry;
@@ -62,8 +62,14 @@ filesys_create (const char *full_name, off_t initial_size, bool is_dir)
   if (!parse_name (full_name, &dir, name))
     return false;
 
+  /* Place the new inode in the parent directory's block group. */
+  block_sector_t hint = 0;
+  if (dir != NULL)
+    hint = free_map_inode_hint (inode_get_inumber (dir_get_inode (dir)),
+                                is_dir);
+
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && free_map_allocate_near (hint, 1, &inode_sector)
                   && inode_create (inode_sector, initial_size, is_dir)
                   && dir_add (dir, name, inode_sector, is_dir));
   if (!success && inode_sector != 0) 
@@ -1,97 +1,378 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* FREE MAP PERSISTENCE:
+ * The in-memory free map is the authoritative copy. Allocations and releases
+ * only mark which sectors of the free map file changed, and free_map_flush
+ * writes just those sectors. The free map file is written straight to
+ * fs_device instead of through the buffer cache, so the cache can flush it
+ * from inside its own critical section.
+ *
+ * Crash consistency comes from two ordering rules:
+ * - The free map is flushed before any dirty cache entry is written back, so
+ *   on disk, every sector that metadata points to is marked allocated.
+ * - Released sectors stay allocated until a full cache write-back has
+ *   persisted the metadata that dropped them, and only then become free.
+ * A crash can leak sectors, but can never hand out a sector that on-disk
+ * metadata still references. */
+
+/* BLOCK GROUPS:
+ * The disk is split into groups of BLOCK_GROUP_SECTORS consecutive sectors.
+ * A file's inode is placed in its parent directory's group, and its data is
+ * allocated first fit starting from its inode, so a directory and the files
+ * in it stay in one region of the disk. A new directory stays with its parent
+ * unless that group is fuller than average, in which case it starts over in
+ * the emptiest group, spreading unrelated trees across the disk. */
+
+/* Bits of the free map stored in each sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Sectors per block group (512 kB). */
+#define BLOCK_GROUP_SECTORS 1024
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Sectors released since the last write-back started, and sectors released
+   before the current write-back started. Both stay set in free_map. */
+static struct bitmap *pending_release;
+static struct bitmap *releasing;
+static size_t pending_release_cnt;
+static size_t releasing_cnt;
+
+/* Free map file sectors that differ from disk, and their device sectors. */
+static struct bitmap *dirty_sectors;
+static block_sector_t *free_map_sectors;
+
+/* Number of free sectors, in total and per block group. Sectors waiting to
+   be released are not counted as free. */
+static size_t free_cnt;
+static size_t group_cnt;
+static size_t *group_free_cnt;
+
+static struct lock free_map_lock;
+
+static void mark_dirty (block_sector_t sector, size_t cnt);
+static bool allocate (block_sector_t hint, size_t cnt,
+    block_sector_t *sectorp);
+static void count_free_sectors (void);
+static void locate_free_map_sectors (void);
+
 /* Initializes the free map. */
 void
-free_map_init (void) 
+free_map_init (void)
 {
-  free_map = bitmap_create (block_size (fs_device));
-  if (free_map == NULL)
+  size_t sector_cnt = block_size (fs_device);
+  struct bitmap *map = bitmap_create (sector_cnt);
+  pending_release = bitmap_create (sector_cnt);
+  releasing = bitmap_create (sector_cnt);
+  if (map == NULL || pending_release == NULL || releasing == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
-  bitmap_mark (free_map, FREE_MAP_SECTOR);
-  bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  dirty_sectors = bitmap_create (DIV_ROUND_UP (bitmap_file_size (map),
+                                               BLOCK_SECTOR_SIZE));
+  if (dirty_sectors == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  group_cnt = DIV_ROUND_UP (sector_cnt, BLOCK_GROUP_SECTORS);
+  group_free_cnt = calloc (group_cnt, sizeof *group_free_cnt);
+  if (group_free_cnt == NULL)
+    PANIC ("block group creation failed");
+  lock_init (&free_map_lock);
+  bitmap_mark (map, FREE_MAP_SECTOR);
+  bitmap_mark (map, ROOT_DIR_SECTOR);
+
+  /* The cache writer thread may already be running. Publish the free map
+     last, since the write-back hooks ignore an uninitialized free map. */
+  free_map = map;
+  lock_acquire (&free_map_lock);
+  count_free_sectors ();
+  lock_release (&free_map_lock);
 }
 
 /* Allocates CNT sectors from the free map and stores them into SECTORP.
    SECTORP should be allocated to hold CNT sectors.
    Returns true if successful, false if not enough sectors were
-   available or if the free_map file could not be written. */
+   available. If only sectors waiting on a write-back are left, forces a
+   write-back so they can be reused. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
+{
+  return free_map_allocate_near (0, cnt, sectorp);
+}
+
+/* Like free_map_allocate, but takes the first free sectors at or after
+   HINT, wrapping around to the start of the disk if needed. */
+bool
+free_map_allocate_near (block_sector_t hint, size_t cnt,
+    block_sector_t *sectorp)
 {
   if (cnt == 0)
     return true;
 
-  size_t allocated = 0;
-  size_t free_map_size = bitmap_size (free_map);
-  for (size_t i = 0; i < free_map_size; ++i)
+  if (allocate (hint, cnt, sectorp))
+    return true;
+
+  lock_acquire (&free_map_lock);
+  bool has_releases = pending_release_cnt + releasing_cnt > 0;
+  lock_release (&free_map_lock);
+  if (!has_releases)
+    return false;
+
+  write_cache_to_disk ();
+  return allocate (hint, cnt, sectorp);
+}
+
+/* Returns the sector to start searching from when allocating the inode of
+   a new file or directory in the directory whose inode is at PARENT. */
+block_sector_t
+free_map_inode_hint (block_sector_t parent, bool is_dir)
+{
+  lock_acquire (&free_map_lock);
+  size_t group = parent / BLOCK_GROUP_SECTORS;
+  if (is_dir && group_free_cnt[group] * group_cnt < free_cnt)
+  {
+    for (size_t i = 0; i < group_cnt; ++i)
+      if (group_free_cnt[i] > group_free_cnt[group])
+        group = i;
+    parent = group * BLOCK_GROUP_SECTORS;
+  }
+  lock_release (&free_map_lock);
+  return parent;
+}
+
+/* Makes CNT sectors starting at SECTOR available for use once the
+   metadata that referenced them has been written back. */
+void
+free_map_release (block_sector_t sector, size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_all (free_map, sector, cnt));
+  ASSERT (bitmap_none (pending_release, sector, cnt));
+  bitmap_set_multiple (pending_release, sector, cnt, true);
+  pending_release_cnt += cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Called by the buffer cache before it writes back every dirty entry.
+   Sectors released so far may be freed once that write-back is done. */
+void
+free_map_writeback_begin (void)
+{
+  if (free_map == NULL)
+    return;
+
+  lock_acquire (&free_map_lock);
+  size_t sector_cnt = bitmap_size (free_map);
+  for (size_t i = 0; pending_release_cnt > 0 && i < sector_cnt; ++i)
   {
-    if (!bitmap_test (free_map, i))
+    if (bitmap_test (pending_release, i))
     {
-      sectorp[allocated++] = i;
-      bitmap_mark (free_map, i);
+      bitmap_reset (pending_release, i);
+      bitmap_mark (releasing, i);
+      --pending_release_cnt;
+      ++releasing_cnt;
     }
-    if (allocated == cnt)
+  }
+  lock_release (&free_map_lock);
+}
+
+/* Called by the buffer cache after it wrote back every dirty entry. No
+   metadata on disk references the sectors released before the write-back
+   began, so they are returned to the free map. */
+void
+free_map_writeback_end (void)
+{
+  if (free_map == NULL)
+    return;
+
+  lock_acquire (&free_map_lock);
+  size_t sector_cnt = bitmap_size (free_map);
+  for (size_t i = 0; releasing_cnt > 0 && i < sector_cnt; ++i)
+  {
+    if (bitmap_test (releasing, i))
     {
-      if (!free_map_file || bitmap_write (free_map, free_map_file))
-        return true;
-      break;
+      bitmap_reset (releasing, i);
+      bitmap_reset (free_map, i);
+      mark_dirty (i, 1);
+      --releasing_cnt;
+      ++free_cnt;
+      ++group_free_cnt[i / BLOCK_GROUP_SECTORS];
     }
   }
-
-  /* On failure, free all the sectors allocated. */
-  for (size_t i = 0; i < allocated; ++i)
-    bitmap_reset (free_map, i);
-  return false;
+  lock_release (&free_map_lock);
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Writes the dirty sectors of the free map to disk. Does nothing until
+   the free map file has been opened or created. */
 void
-free_map_release (block_sector_t sector, size_t cnt)
+free_map_flush (void)
 {
-  ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  static uint8_t buffer[BLOCK_SECTOR_SIZE];
+
+  if (free_map == NULL)
+    return;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_sectors != NULL)
+  {
+    size_t file_size = bitmap_file_size (free_map);
+    size_t i = 0;
+    while ((i = bitmap_scan (dirty_sectors, i, 1, true)) != BITMAP_ERROR)
+    {
+      size_t ofs = i * BLOCK_SECTOR_SIZE;
+      size_t size = file_size - ofs < BLOCK_SECTOR_SIZE ?
+        file_size - ofs : BLOCK_SECTOR_SIZE;
+      memset (buffer, 0, BLOCK_SECTOR_SIZE);
+      bitmap_get_bytes (free_map, ofs, buffer, size);
+      block_write (fs_device, free_map_sectors[i], buffer);
+      bitmap_reset (dirty_sectors, i);
+    }
+  }
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
 void
-free_map_open (void) 
+free_map_open (void)
 {
+  static uint8_t buffer[BLOCK_SECTOR_SIZE];
+
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_read (free_map, free_map_file))
-    PANIC ("can't read free map");
+  locate_free_map_sectors ();
+
+  /* Read around the buffer cache, which may hold stale copies of the
+     free map file from when it was created. */
+  lock_acquire (&free_map_lock);
+  size_t file_size = bitmap_file_size (free_map);
+  for (size_t i = 0; i < bitmap_size (dirty_sectors); ++i)
+  {
+    size_t ofs = i * BLOCK_SECTOR_SIZE;
+    size_t size = file_size - ofs < BLOCK_SECTOR_SIZE ?
+      file_size - ofs : BLOCK_SECTOR_SIZE;
+    block_read (fs_device, free_map_sectors[i], buffer);
+    bitmap_set_bytes (free_map, ofs, buffer, size);
+  }
+  bitmap_set_all (dirty_sectors, false);
+  count_free_sectors ();
+  lock_release (&free_map_lock);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
-free_map_close (void) 
+free_map_close (void)
 {
+  free_map_flush ();
+  lock_acquire (&free_map_lock);
+  free (free_map_sectors);
+  free_map_sectors = NULL;
+  lock_release (&free_map_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
    it. */
 void
-free_map_create (void) 
+free_map_create (void)
 {
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
+  /* Write bitmap to file. This goes through the buffer cache, so write the
+     cache back before later flushes start writing around it. */
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  write_cache_to_disk ();
+  locate_free_map_sectors ();
+}
+
+/* Allocates CNT sectors, first fit from HINT, from sectors that are free
+   right now. Returns false without allocating anything if there are not
+   enough. */
+static bool
+allocate (block_sector_t hint, size_t cnt, block_sector_t *sectorp)
+{
+  lock_acquire (&free_map_lock);
+  if (free_cnt < cnt)
+  {
+    lock_release (&free_map_lock);
+    return false;
+  }
+
+  size_t sector = hint < bitmap_size (free_map) ? hint : 0;
+  for (size_t i = 0; i < cnt; ++i)
+  {
+    size_t next = bitmap_scan_and_flip (free_map, sector, 1, false);
+    if (next == BITMAP_ERROR)
+      next = bitmap_scan_and_flip (free_map, 0, 1, false);
+    ASSERT (next != BITMAP_ERROR);
+    sector = next;
+    sectorp[i] = sector;
+    mark_dirty (sector, 1);
+    --free_cnt;
+    --group_free_cnt[sector / BLOCK_GROUP_SECTORS];
+  }
+  lock_release (&free_map_lock);
+  return true;
+}
+
+/* Recomputes the free sector counts from the free map. Caller must hold
+   free_map_lock. */
+static void
+count_free_sectors (void)
+{
+  size_t sector_cnt = bitmap_size (free_map);
+  free_cnt = 0;
+  for (size_t i = 0; i < group_cnt; ++i)
+  {
+    size_t start = i * BLOCK_GROUP_SECTORS;
+    size_t cnt = sector_cnt - start < BLOCK_GROUP_SECTORS ?
+      sector_cnt - start : BLOCK_GROUP_SECTORS;
+    group_free_cnt[i] = bitmap_count (free_map, start, cnt, false);
+    free_cnt += group_free_cnt[i];
+  }
+}
+
+/* Marks the free map file sectors holding bits SECTOR through
+   SECTOR + CNT - 1 as dirty. Caller must hold free_map_lock. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+  bitmap_set_multiple (dirty_sectors, first, last - first + 1, true);
+}
+
+/* Looks up the device sectors that hold the free map file's data, so the
+   free map can be flushed without going through the file system. */
+static void
+locate_free_map_sectors (void)
+{
+  size_t sector_cnt = bitmap_size (dirty_sectors);
+  block_sector_t *sectors = malloc (sector_cnt * sizeof *sectors);
+  if (sectors == NULL)
+    PANIC ("can't allocate free map sector list");
+
+  struct inode *inode = file_get_inode (free_map_file);
+  for (size_t i = 0; i < sector_cnt; ++i)
+    sectors[i] = inode_byte_to_sector (inode, i * BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&free_map_lock);
+  free (free_map_sectors);
+  free_map_sectors = sectors;
+  lock_release (&free_map_lock);
 }
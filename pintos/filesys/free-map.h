@@ -12,6 +12,12 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (block_sector_t hint, size_t, block_sector_t *);
+block_sector_t free_map_inode_hint (block_sector_t parent, bool is_dir);
 void free_map_release (block_sector_t, size_t);
 
+void free_map_flush (void);
+void free_map_writeback_begin (void);
+void free_map_writeback_end (void);
+
 #endif /* filesys/free-map.h */
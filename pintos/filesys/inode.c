@@ -82,7 +82,7 @@ static char zeros[BLOCK_SECTOR_SIZE];
 static struct list open_inodes;
 
 static bool inode_disk_extend (struct inode_disk *inode_disk,
-    off_t new_length);
+    block_sector_t sector, off_t new_length);
 static struct inode_disk *inode_get_data (const struct inode *inode);
 static void inode_disk_free (struct inode_disk *inode_disk);
 static void inode_disk_free_sector (block_sector_t sector,
@@ -211,7 +211,7 @@ inode_create (block_sector_t sector, off_t length, bool is_dir)
       inode_disk->length = 0;
       inode_disk->is_dir = is_dir;
       inode_disk->magic = INODE_MAGIC;
-      if (inode_disk_extend (inode_disk, length))
+      if (inode_disk_extend (inode_disk, sector, length))
         cache_write (sector, inode_disk);
       free (inode_disk);
       return true;
@@ -371,7 +371,7 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 
   /* Extend the inode if necessary. */
   struct inode_disk *inode_disk = inode_get_data (inode);
-  if (inode_disk_extend (inode_disk, offset + size))
+  if (inode_disk_extend (inode_disk, inode->sector, offset + size))
     cache_write (inode->sector, inode_disk);
 
   while (size > 0) 
@@ -432,6 +432,18 @@ inode_get_sector (const struct inode *inode)
   return -1;
 }
 
+/* Returns the device sector that holds byte offset POS of INODE, or -1
+   if INODE has no data at POS. */
+block_sector_t
+inode_byte_to_sector (const struct inode *inode, off_t pos)
+{
+  struct inode_disk *inode_disk = inode_get_data (inode);
+  block_sector_t sector = pos < inode_disk->length ?
+    byte_to_sector (inode_disk, pos) : (block_sector_t) -1;
+  free (inode_disk);
+  return sector;
+}
+
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
@@ -569,9 +581,11 @@ inode_disk_extend_doubly_indblock_children (block_sector_t doubly_indblock,
  * inode_disk, writes indblock pointers to disk, and fills dblocks with zeros.
  * Returns if the size of the inode is the same or sucessfully increased. 
  * This should be called from inode_write_at to allow file extension, and
- * from inode_create, with inode_disk->length = 0. */
+ * from inode_create, with inode_disk->length = 0. New sectors are allocated
+ * near SECTOR, the inode's own sector, to keep the file in its block group. */
 static bool
-inode_disk_extend (struct inode_disk *inode_disk, off_t new_length)
+inode_disk_extend (struct inode_disk *inode_disk, block_sector_t sector,
+    off_t new_length)
 {
   if (!inode_disk || new_length < inode_disk->length)
     return false;
@@ -596,7 +610,8 @@ inode_disk_extend (struct inode_disk *inode_disk, off_t new_length)
 
   /* Allocate new sectors. Return if there is an allocation failure. */
   block_sector_t *sectors = malloc (sizeof (block_sector_t) * sectors_to_write);
-  if (!sectors || !free_map_allocate (sectors_to_write, sectors))
+  if (!sectors || !free_map_allocate_near (sector, sectors_to_write,
+                                          sectors))
     return false;
   block_sector_t *sectors_orig = sectors;
   block_sector_t *indirect_sectors = sectors + data_sectors_to_write;
@@ -19,6 +19,7 @@ off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 block_sector_t inode_get_sector (const struct inode *node);
+block_sector_t inode_byte_to_sector (const struct inode *, off_t pos);
 off_t inode_length (const struct inode *);
 bool inode_is_dir (const struct inode *);
 
@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -302,10 +303,21 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      elem_type skip = value ? 0 : (elem_type) -1;
+      size_t i = start;
+      while (i <= last)
+        {
+          /* Step over a whole element at a time while none of
+             its bits is VALUE. */
+          if (i % ELEM_BITS == 0 && b->bits[elem_idx (i)] == skip)
+            {
+              i += ELEM_BITS;
+              continue;
+            }
+          if (!bitmap_contains (b, i, cnt, !value))
+            return i; 
+          i++;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -326,6 +338,34 @@ bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
   return idx;
 }
 
+/* Raw byte access. */
+
+/* Copies CNT bytes of B's bits, starting at byte OFS, into DST.
+   The byte layout is the same one bitmap_write() stores on disk. */
+void
+bitmap_get_bytes (const struct bitmap *b, size_t ofs, void *dst, size_t cnt)
+{
+  ASSERT (b != NULL);
+  ASSERT (dst != NULL || cnt == 0);
+  ASSERT (ofs + cnt <= byte_cnt (b->bit_cnt));
+
+  memcpy (dst, (const uint8_t *) b->bits + ofs, cnt);
+}
+
+/* Copies CNT bytes from SRC into B's bits, starting at byte OFS.
+   The inverse of bitmap_get_bytes(). */
+void
+bitmap_set_bytes (struct bitmap *b, size_t ofs, const void *src, size_t cnt)
+{
+  ASSERT (b != NULL);
+  ASSERT (src != NULL || cnt == 0);
+  ASSERT (ofs + cnt <= byte_cnt (b->bit_cnt));
+
+  memcpy ((uint8_t *) b->bits + ofs, src, cnt);
+  if (b->bit_cnt > 0)
+    b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+}
+
 /* File input and output. */
 
 #ifdef FILESYS
@@ -37,6 +37,10 @@ bool bitmap_all (const struct bitmap *, size_t start, size_t cnt);
 size_t bitmap_scan (const struct bitmap *, size_t start, size_t cnt, bool);
 size_t bitmap_scan_and_flip (struct bitmap *, size_t start, size_t cnt, bool);
 
+/* Raw byte access. */
+void bitmap_get_bytes (const struct bitmap *, size_t ofs, void *, size_t cnt);
+void bitmap_set_bytes (struct bitmap *, size_t ofs, const void *, size_t cnt);
+
 /* File input and output. */
 #ifdef FILESYS
 struct file;
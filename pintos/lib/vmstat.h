@@ -0,0 +1,26 @@
+#ifndef __LIB_VMSTAT_H
+#define __LIB_VMSTAT_H
+
+/* Virtual memory statistics for one process, as returned by the
+   vmstat system call.
+
+   A major fault has to read the page from a file or from swap; a
+   minor fault is resolved in memory.  Every fault counted in
+   filesys_faults, swap_faults, fill_faults, stack_faults and
+   cow_faults is also counted as either major or minor. */
+struct vmstat
+  {
+    unsigned minor_faults;      /* Faults resolved without I/O. */
+    unsigned major_faults;      /* Faults that waited for I/O. */
+    unsigned filesys_faults;    /* Faults on pages in a file. */
+    unsigned swap_faults;       /* Faults on pages in swap. */
+    unsigned fill_faults;       /* Faults on same-filled pages. */
+    unsigned stack_faults;      /* Faults that grew the stack. */
+    unsigned cow_faults;        /* First writes to copy-on-write pages. */
+    unsigned evictions;         /* Pages evicted. */
+    unsigned swap_ins;          /* Pages read back from swap. */
+    unsigned rss;               /* Pages resident now. */
+    unsigned max_rss;           /* Most pages resident at once. */
+  };
+
+#endif /* lib/vmstat.h */
@@ -0,0 +1,67 @@
+/* Writes 2 MB of memory, more than fits in physical memory, then
+   reads it back, and checks that the vmstat system call reports
+   the evictions and swap faults that this causes. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+
+static char buf[SIZE];
+
+/* Returns the value the test stores at offset I of buf.  It
+   varies within every page, so that no page is filled with one
+   repeated word and evicted pages must go to swap. */
+static char
+pattern (size_t i)
+{
+  return i % 251;
+}
+
+/* Fails unless S is self-consistent. */
+static void
+check_consistent (const struct vmstat *s)
+{
+  if (s->rss == 0 || s->rss > s->max_rss)
+    fail ("rss %u, max_rss %u", s->rss, s->max_rss);
+  if (s->major_faults + s->minor_faults
+      < s->filesys_faults + s->swap_faults + s->fill_faults
+        + s->stack_faults + s->cow_faults)
+    fail ("major and minor faults do not cover every fault");
+}
+
+void
+test_main (void)
+{
+  struct vmstat start, written, read;
+  size_t i;
+
+  CHECK (vmstat (&start), "vmstat");
+  check_consistent (&start);
+
+  msg ("write pass");
+  for (i = 0; i < SIZE; i++)
+    buf[i] = pattern (i);
+  CHECK (vmstat (&written), "vmstat");
+  check_consistent (&written);
+  if (written.evictions <= start.evictions)
+    fail ("no evictions counted after writing %d bytes", SIZE);
+  if (written.major_faults + written.minor_faults
+      <= start.major_faults + start.minor_faults)
+    fail ("no faults counted after writing %d bytes", SIZE);
+
+  msg ("read pass");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != pattern (i))
+      fail ("byte %zu is wrong", i);
+  CHECK (vmstat (&read), "vmstat");
+  check_consistent (&read);
+  if (read.swap_faults <= written.swap_faults)
+    fail ("no swap faults counted after reading evicted pages");
+  if (read.swap_ins - written.swap_ins < read.swap_faults - written.swap_faults)
+    fail ("fewer pages read from swap than swap faults");
+  if (read.max_rss < written.max_rss)
+    fail ("max_rss went down");
+}
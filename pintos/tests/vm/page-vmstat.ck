@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-vmstat) begin
+(page-vmstat) vmstat
+(page-vmstat) write pass
+(page-vmstat) vmstat
+(page-vmstat) read pass
+(page-vmstat) vmstat
+(page-vmstat) end
+EOF
+pass;
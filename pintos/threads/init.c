@@ -36,6 +36,8 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/iosched.h"
+#include "devices/ramdisk.h"
 #include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
@@ -55,6 +57,9 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/* -ramdisk: Size of RAM disk to create, in kB, or 0 for none. */
+static size_t ramdisk_kb;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
@@ -101,7 +106,6 @@ main (void)
   palloc_init (user_page_limit);
   malloc_init ();
   paging_init ();
-  spage_init ();
   falloc_init ();
 
   /* Segmentation. */
@@ -128,10 +132,13 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  if (ramdisk_kb > 0)
+    ramdisk_init (ramdisk_kb);
   locate_block_devices ();
   cache_init ();
   filesys_init (format_filesys);
   swalloc_init ();
+  pageout_init ();
 #endif
 
   printf ("Boot complete.\n");
@@ -254,6 +261,20 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ramdisk"))
+        {
+          int kb = value != NULL ? atoi (value) : 0;
+          if (kb <= 0)
+            PANIC ("-ramdisk requires a size in kB, e.g. -ramdisk=1024 "
+                   "(use -h for help)");
+          ramdisk_kb = kb;
+        }
+      else if (!strcmp (name, "-iosched"))
+        {
+          if (value == NULL || !iosched_select (value))
+            PANIC ("unknown I/O scheduler `%s' (use -h for help)",
+                   value != NULL ? value : "");
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -266,6 +287,8 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-vmstat"))
+        process_print_vmstat = true;
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -380,6 +403,9 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ramdisk=KB        Create a KB-kilobyte RAM disk named ram0.\n"
+          "  -iosched=POLICY    Order disk requests by POLICY: fifo (the\n"
+          "                     default), cscan, or deadline.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -388,6 +414,7 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -vmstat            Print paging statistics as processes exit.\n"
 #endif
           );
   shutdown_power_off ();
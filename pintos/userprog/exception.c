@@ -153,11 +153,16 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  /* If the fault is a rights violation on user memory, whether from user or
-   * kernel mode, it probably means a user program is attempting to write 
-   * into a page without write permissions. Exit the thread. */
+  /* A rights violation on user memory, whether from user or kernel mode, is
+   * either the first write to a copy-on-write page, which gets its own copy
+   * of the frame, or a user program attempting to write into a page without
+   * write permissions. Exit the thread in the latter case. */
   if (!not_present)
+  {
+    if (write && is_user_vaddr (fault_addr) && page_write_fault (fault_addr))
+      return;
     exit (-1);
+  }
 
   /* If page is not present, attempt to load the page from outside of main
    * memory. */
@@ -23,8 +23,11 @@
 #include "vm/frame.h"
 #include "vm/page.h"
 
+bool process_print_vmstat;
+
 static thread_func start_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static void print_vmstat (struct process *p);
 
 /* Get exit status entry for the given pid */
 static struct process *
@@ -106,6 +109,13 @@ process_execute (const char *file_name)
     list_init (&process->fd_map);
     hash_init (&process->mapid_map, mapid_hash, mapid_less, NULL);
 		hash_init (&process->spage_table, page_hash, page_less, NULL); 
+    lock_init (&process->spage_lock);
+    list_init (&process->regions);
+    memset (&process->vmstat, 0, sizeof process->vmstat);
+    process->last_fault_tick = 0;
+    process->ws_window = 0;
+    process->last_file_fault = NULL;
+    process->fault_around = 0;
     list_push_back (&process_list, &process->elem);
   }
 
@@ -248,6 +258,8 @@ process_exit (void)
     clean_child_processes (p->pid);
     if (p->executable)
       file_close (p->executable);
+    if (process_print_vmstat)
+      print_vmstat (p);
     hash_destroy (&p->spage_table, page_destructor);
   }
 
@@ -271,6 +283,25 @@ process_exit (void)
     }
 }
 
+/* Prints process P's paging statistics. */
+static void
+print_vmstat (struct process *p)
+{
+  struct vmstat s;
+
+  lock_acquire (&p->spage_lock);
+  s = p->vmstat;
+  lock_release (&p->spage_lock);
+
+  printf ("%s: faults: %u minor, %u major (%u filesys, %u swap, %u fill, "
+          "%u stack, %u cow)\n",
+          p->file_name, s.minor_faults, s.major_faults, s.filesys_faults,
+          s.swap_faults, s.fill_faults, s.stack_faults, s.cow_faults);
+  printf ("%s: pages: %u evicted, %u swapped in, %u resident, "
+          "%u max resident\n",
+          p->file_name, s.evictions, s.swap_ins, s.rss, s.max_rss);
+}
+
 /* Sets up the CPU for running user code in the current
    thread.
    This function is called on every context switch. */
@@ -1,6 +1,7 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include <vmstat.h>
 #include "lib/kernel/hash.h"
 #include "threads/thread.h"
 
@@ -30,12 +31,23 @@ struct process
   struct list fd_map;
   struct hash mapid_map;
 	struct hash spage_table;		/* Supplemental page table. */
+  struct lock spage_lock;     /* Guards spage_table, its pages, regions. */
+  struct list regions;        /* Regions of struct region, e.g. mmaps. */
+  struct vmstat vmstat;       /* Paging statistics, guarded by spage_lock. */
+  int64_t last_fault_tick;    /* When a page was last faulted in. */
+  unsigned ws_window;         /* Working-set window, in timer ticks. */
+  void *last_file_fault;      /* Page of the last file-backed fault. */
+  size_t fault_around;        /* Pages to map after a file-backed fault. */
   struct list_elem elem;
 };
 
 /* List of processes */
 struct list process_list;
 
+/* If true, print each process's paging statistics when it exits.
+   Controlled by kernel command-line option "-vmstat". */
+extern bool process_print_vmstat;
+
 void clean_child_processes (pid_t pid);
 tid_t process_execute (const char *file_name);
 int process_wait (tid_t);
@@ -183,8 +183,9 @@ mapid_lookup (int mapid)
 	return NULL;
 }
 
-/* Create a new mapid_entry mapping pages to file open in fd. Returns a pointer
- * to the mapid_entry, or NULL if there is a failure. */
+/* Create a new mapid_entry mapping the file open in fd to pages starting at
+ * addr. Returns a pointer to the mapid_entry, or NULL if there is a failure,
+ * including if the pages overlap pages already in use. */
 struct mapid_entry*
 create_mapid (int fd, void* addr)
 {
@@ -192,19 +193,25 @@ create_mapid (int fd, void* addr)
 
   struct process *process = thread_current ()->process;
   struct file_descriptor *file_descriptor = get_file_descriptor (fd);
-  if (process && file_descriptor && !file_descriptor->is_dir &&
-      file_length (file_descriptor->file.file) > 0)
+  if (process && file_descriptor && !file_descriptor->is_dir)
   {
+    struct file *file = file_descriptor->file.file;
+    struct mapid_entry *mapid = malloc (sizeof (struct mapid_entry));
+    if (mapid == NULL)
+      return NULL;
+    mapid->region = region_create (addr, file, 0, file_length (file), true);
+    if (mapid->region == NULL)
+    {
+      free (mapid);
+      return NULL;
+    }
+
     /* Find an available mapid. */
     for (int i = 0; true; ++i)
     {
       if (!mapid_lookup (i))
       {
-        struct mapid_entry *mapid = malloc (sizeof (struct mapid_entry));
         mapid->mapid = i;
-        mapid->file = file_reopen (file_descriptor->file.file);
-        mapid->addr = addr;
-        mapid->length = file_length (mapid->file);
         hash_insert (&process->mapid_map, &mapid->hash_elem);
         return mapid;
       }
@@ -245,49 +252,12 @@ mapid_destructor (struct hash_elem *hash_elem, void *aux UNUSED)
     internal_remove_mapid (mapid_entry);
 }
 
-/* Clean mapid_entry resources, and write its pages to disk. */
+/* Clean mapid_entry resources, and write its modified pages to disk. */
 static void
 internal_remove_mapid (struct mapid_entry *mapid_entry)
 {
   ASSERT (mapid_entry);
 
-  /* Write the mmap page contents to kernel space first, then write it to
-   * to disk. This is to avoid page faults, which must not occure during
-   * filesys access. Page faults can occur if a mmap page is not in memory.
-   * TODO: find a better way to avoid page faults without doing a full
-   * malloc/memcpy. This way is costly, and doesn't fully ensure that the
-   * contents will be in memory. */
-  file_seek (mapid_entry->file, 0);
-  void *addr = mapid_entry->addr;
-  int write_bytes = mapid_entry->length;
-  void *file_contents = malloc (PGSIZE);
-  while (write_bytes > 0)
-  {
-    if (pagedir_is_dirty (thread_current ()->pagedir, addr))
-    {
-      int page_write_bytes = write_bytes > PGSIZE ? PGSIZE : write_bytes;
-      memcpy (file_contents, addr, page_write_bytes);
-      file_write (mapid_entry->file, file_contents, page_write_bytes);
-    }
-
-    addr += PGSIZE;
-    write_bytes -= PGSIZE;
-  }
-  free (file_contents);
-
-  /* No requirement listed to set the file position back to 0, but test
-   * cases imply so. */
-  file_seek (mapid_entry->file, 0);
-
-  /* Free pages. */
-  addr = pg_round_down (mapid_entry->addr);
-  void *end_addr = mapid_entry->addr + mapid_entry->length;
-  while (addr <= end_addr)
-  {
-    page_free (addr);
-    addr += PGSIZE;
-  }
-
-  file_close (mapid_entry->file);
+  region_destroy (mapid_entry->region);
   free (mapid_entry);
 }
@@ -23,9 +23,7 @@ struct file_descriptor
 struct mapid_entry
 {
   int mapid;
-  struct file *file;
-  void *addr;
-  unsigned length;
+  struct region *region;      /* The mapped pages. */
   struct hash_elem hash_elem;
 };
 
@@ -284,44 +284,8 @@ mmap (int fd, void *addr)
   int mapid = -1;
 
   struct mapid_entry *mapid_entry = create_mapid (fd, addr);
-  struct file_descriptor *file_descriptor = get_file_descriptor (fd);
-  if (mapid_entry && file_descriptor && !file_descriptor->is_dir)
-  {
-    struct file* file = file_descriptor->file.file;
-    int len = file_length (file);
-
-    /* Check that all pages are availible. It is more efficient to check in two
-     * loops. Checking and mapping in the same loop would require freeing
-     * previously allocated pages if there is a failed check. */
-    void *paddr = addr;
-    int ofs = 0;
-    while (ofs < len)
-    {
-      if (page_exists (paddr + ofs))
-      {
-        release_filesys_syscall_lock ();
-        return -1;
-      }
-      paddr += PGSIZE;
-      ofs += PGSIZE;
-    }
-
-    /* Lazy load a page in each loop iteration. */
-    paddr = addr;
-    ofs = 0;
-    while (ofs < len)
-    {
-      /* Only read the remaining bytes for the last page. */
-      int bytes_left = len - ofs;
-      int page_read_bytes = bytes_left > PGSIZE ? PGSIZE : bytes_left;
-
-      lazy_load_segment (paddr, file, ofs, page_read_bytes,
-          PGSIZE - page_read_bytes, true);
-      paddr += PGSIZE;
-      ofs += PGSIZE;
-    }
+  if (mapid_entry)
     mapid = mapid_entry->mapid;
-  }
   release_filesys_syscall_lock ();
   return mapid;
 }
@@ -393,6 +357,20 @@ inumber (int fd)
   return result;
 }
 
+static bool
+vmstat (struct vmstat *stats)
+{
+  validate_uaddr (stats);
+  validate_uaddr ((char *) stats + sizeof *stats - 1);
+
+  /* Copy out without holding the page table lock, since writing to stats
+   * may fault. */
+  struct vmstat copy;
+  page_get_vmstat (&copy);
+  *stats = copy;
+  return true;
+}
+
 static void
 syscall_handler (struct intr_frame *f) 
 {
@@ -484,6 +462,10 @@ syscall_handler (struct intr_frame *f)
       validate_args (esp, 1);
       f->eax = inumber (*(int *)(esp + 4));
       break;
+    case SYS_VMSTAT:
+      validate_args (esp, 1);
+      f->eax = vmstat (*(struct vmstat **)(esp + 4));
+      break;
     default:
       thread_exit();
   }
@@ -1,6 +1,11 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include "threads/synch.h"
+
+/* Serializes file system calls, and writes of mapped files back to them. */
+extern struct lock filesys_syscall_lock;
+
 void syscall_init (void);
 void exit (int status);
 
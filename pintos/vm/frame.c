@@ -1,163 +1,717 @@
 #include "vm/frame.h"
+#include <debug.h>
+#include <hash.h>
+#include <string.h>
 #include "devices/timer.h"
 #include "lib/kernel/list.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "userprog/pagedir.h"
+#include "userprog/process.h"
 #include "vm/page.h"
 
 static struct frame *get_frame (void *kpage);
 static struct frame *get_frame_to_evict (void);
+static bool frame_accessed (struct frame *frame);
+static int64_t frame_ws_window (struct frame *frame);
 
 /* Contains one entry for each frame that contains a user page */
 struct list frame_table;
 
 struct frame {
   void *kpage;
-  struct page *page;
+  struct page *page;    /* Null if the frame is not in use. For a shared
+                           frame, any one of the pages mapping it. */
 
-  /* Used for eviction clock algorithm. */
-  int64_t last_accessed_tick;
+  /* A pinned frame is never chosen for eviction, and ffree waits for it to be
+   * unpinned. Frames are pinned while an eviction writes them out and while
+   * falloc's caller fills them. */
+  bool pinned;
+
+  /* A shared frame holds a clean page of an executable, read_bytes bytes
+   * from offset ofs in inode followed by zeros, and is mapped read-only by
+   * every process running it that has faulted the page in. It is found
+   * through share_table, and freed when the last of its pages lets go of
+   * it. For a private frame, inode is null. */
+  struct inode *inode;
+  off_t ofs;
+  uint32_t read_bytes;
+  unsigned refcnt;              /* Number of pages mapping the frame. */
+  struct list sharers;          /* Those pages, if shared. */
+  struct hash_elem share_elem;  /* Element in share_table, if shared. */
+
+  /* When the frame was last seen accessed, in timer ticks. */
+  int64_t last_used;
 
   struct list_elem elem;
 };
 
-/* Lock to ensure only one thread is accessing the frame at a time. */
+/* One entry per user pool page, indexed by palloc_user_page_idx (),
+ * so the frame holding a kpage is found in constant time. Entries in use
+ * are also linked into frame_table. */
+static struct frame *frames;
+
+/* Next frame in frame_table for the eviction clock to examine, or
+ * list_end (&frame_table) to start over from the front. */
+static struct list_elem *clock_hand;
+
+/* Protects frame_table, the clock hand, and the page and pinned members of
+ * every frame. It is never held across disk I/O: eviction picks and pins a
+ * victim under the lock, then writes it out without the lock. */
 struct lock frame_lock;
 
+/* Shared frames, by inode and offset. Protected by frame_lock. */
+static struct hash share_table;
+
+/* Signaled when a frame is unpinned. */
+static struct condition frame_unpinned;
+
+/* Background page-out. When fewer than low_water user frames are free,
+ * falloc wakes the pageout thread, which evicts pages until high_water frames
+ * are free again. Faults then usually find a free frame instead of waiting
+ * for a victim to be written out. */
+static size_t frame_cnt;                /* Frames in the user pool. */
+static size_t frames_used;              /* Frames in frame_table. */
+static size_t low_water, high_water;
+static struct condition pageout_wanted; /* Signaled when below low_water. */
+
+/* Ticks between passes of the flusher thread over mapped-file pages. */
+#define FLUSH_INTERVAL TIMER_FREQ
+
+static void pageout_thread (void *aux);
+static void flusher_thread (void *aux);
+static bool page_out_one (void);
+static struct frame *evict_one (void);
+static struct frame *evict_begin (bool *to_swap);
+static void evict_end (struct frame *frame, swap_page_t swap_page);
+static void frame_install (struct frame *frame, void *kpage,
+    struct page *page);
+static void frame_unlink (struct frame *frame);
+static struct frame *share_lookup (const struct page *page);
+static unsigned share_hash (const struct hash_elem *e, void *aux);
+static bool share_less (const struct hash_elem *a, const struct hash_elem *b,
+    void *aux);
+
 void
 falloc_init (void) {
+  frame_cnt = palloc_user_page_cnt ();
+
   list_init (&frame_table);
   lock_init (&frame_lock);
+  cond_init (&frame_unpinned);
+  cond_init (&pageout_wanted);
+  hash_init (&share_table, share_hash, share_less, NULL);
+
+  frames = calloc (frame_cnt, sizeof *frames);
+  if (frames == NULL && frame_cnt > 0)
+    PANIC ("falloc_init: out of memory for %zu frames", frame_cnt);
+
+  low_water = frame_cnt / 64 + 1;
+  high_water = frame_cnt / 32 + 2;
 }
 
-/* Allocates a page and returns a pointer to it. If no frames are
- * are availible, evict a used frame. */
+/* Starts the pageout and flusher threads. Must be called after the thread
+ * system and swap are initialized. */
+void
+pageout_init (void)
+{
+  thread_create ("pageout", PRI_DEFAULT, pageout_thread, NULL);
+  thread_create ("flusher", PRI_DEFAULT, flusher_thread, NULL);
+}
+
+/* Allocates a page for PAGE and returns a pointer to it. If no frames are
+ * availible, evicts a used frame. The frame is returned pinned, so that it
+ * cannot be evicted before the caller fills and maps it; the caller must
+ * then call frame_unpin. */
 void *
 falloc (struct page *page, enum palloc_flags flags)
 {
+  void *kpage = falloc_nowait (page, flags);
+  if (kpage)
+    return kpage;
+
+  /* No frame is available, so the pageout thread has fallen behind. Evict a
+   * page ourselves and take over its frame. */
+  struct frame *frame;
+  while ((frame = evict_one ()) == NULL)
+    timer_sleep (1);
+
+  lock_acquire (&frame_lock);
+  frame_install (frame, frame->kpage, page);
+  lock_release (&frame_lock);
+
+  if (flags & PAL_ZERO)
+    memset (frame->kpage, 0, PGSIZE);
+  return frame->kpage;
+}
+
+/* Like falloc, but returns NULL instead of evicting a page if no frame is
+ * free. */
+void *
+falloc_nowait (struct page *page, enum palloc_flags flags)
+{
+  ASSERT (flags & PAL_USER);
+
   lock_acquire (&frame_lock);
   void *kpage = palloc_get_page (flags);
   if (kpage)
+    frame_install (&frames[palloc_user_page_idx (kpage)], kpage, page);
+  if (frame_cnt - frames_used < low_water)
+    cond_signal (&pageout_wanted, &frame_lock);
+  lock_release (&frame_lock);
+  return kpage;
+}
+
+/* Returns a frame that another process already holds the data of PAGE, a
+ * shareable page in the filesys, in, attaching PAGE to it. The frame is
+ * returned pinned, like falloc's, and must be mapped read-only. Returns NULL
+ * if no frame holds that data, in which case the caller should load it into
+ * a frame of its own and offer it with frame_share. */
+void *
+falloc_shared (struct page *page)
+{
+  /* A pinned shared frame may be in the middle of being evicted, so wait to
+   * see whether it stays. */
+  lock_acquire (&frame_lock);
+  struct frame *frame;
+  while ((frame = share_lookup (page)) != NULL && frame->pinned)
+    cond_wait (&frame_unpinned, &frame_lock);
+  if (frame != NULL)
   {
-    struct frame *frame = malloc (sizeof (struct frame));
-    frame->kpage = kpage;
-    frame->page = page;
-    frame->last_accessed_tick = timer_ticks ();
-    page->kpage = kpage;
-    list_push_back (&frame_table, &frame->elem);
-    lock_release (&frame_lock);
-    return kpage;
+    frame->pinned = true;
+    frame->refcnt++;
+    list_push_back (&frame->sharers, &page->share_elem);
+    page->kpage = frame->kpage;
   }
+  lock_release (&frame_lock);
+  return frame != NULL ? frame->kpage : NULL;
+}
 
-  /* No frame is available. Evict a page and load it into swap. The page
-   * requesting a frame will point to the kpage of the evicted page. */
-  struct frame *evict_frame = get_frame_to_evict ();
-  struct page *evict_page = evict_frame->page;
-
-  list_remove (&evict_frame->elem);
-  list_push_back (&frame_table, &evict_frame->elem);
+/* Makes the frame holding PAGE, a shareable page that has just been loaded
+ * from its file and is mapped read-only, available to other processes
+ * through falloc_shared. If another process loaded the same data meanwhile,
+ * the frame just stays private. */
+void
+frame_share (struct page *page)
+{
+  lock_acquire (&frame_lock);
+  struct frame *frame = get_frame (page->kpage);
+  ASSERT (frame != NULL && frame->page == page && frame->inode == NULL);
+  frame->inode = file_get_inode (page->file);
+  frame->ofs = page->ofs;
+  frame->read_bytes = page->read_bytes;
+  if (hash_insert (&share_table, &frame->share_elem) == NULL)
+    list_push_back (&frame->sharers, &page->share_elem);
+  else
+    frame->inode = NULL;
+  lock_release (&frame_lock);
+}
 
-  /* If page is unmodified and comes from a file, evict the page to
-   * filesys. Check upage and kpage dirty bit, since
-   * they are both aliased to the same frame. */
-  uint32_t *pagedir = get_thread (evict_page->tid)->pagedir;
-  if (!pagedir_is_dirty (pagedir, evict_page->upage) &&
-      !pagedir_is_dirty (pagedir, evict_page->kpage) &&
-      evict_page->file)
-    evict_page->present = PRESENT_FILESYS;
+/* Gives PAGE, which is in memory, a frame of its own that it may write: its
+ * current frame if no other page shares it, otherwise a copy. This is how a
+ * write to a copy-on-write page is resolved. Returns the frame, pinned. */
+void *
+frame_unshare (struct page *page)
+{
+  lock_acquire (&frame_lock);
+  struct frame *old = get_frame (page->kpage);
+  ASSERT (old != NULL);
+  while (old->pinned)
+    cond_wait (&frame_unpinned, &frame_lock);
 
-  /* If unable to evict page to filesys, evict to swap. */
-  else
+  old->pinned = true;
+  if (old->inode == NULL || old->refcnt == 1)
   {
-    swap_page_t swap_page = swalloc ();
-    swap_page_write (swap_page, evict_page->kpage);
-    evict_page->present = PRESENT_SWAP;
-    evict_page->swap_page = swap_page;
+    /* Nobody else uses the frame, so take it over. */
+    if (old->inode != NULL)
+    {
+      hash_delete (&share_table, &old->share_elem);
+      old->inode = NULL;
+    }
+    lock_release (&frame_lock);
+    return old->kpage;
   }
+  lock_release (&frame_lock);
 
-  evict_frame->page = page;
-  page->kpage = evict_page->kpage;
-  evict_page->kpage = NULL;
-
-  /* Clear the evicted pages upage mapping from its process's page
-   * directory. */
-  struct thread *t = get_thread (evict_page->tid);
-  if (t)
-    pagedir_clear_page (t->pagedir, evict_page->upage);
+  /* Keeping the old frame pinned stops it from being evicted, even by our
+   * own falloc, and stops its other pages from detaching, until the copy is
+   * made. */
+  void *kpage = falloc (page, PAL_USER);
+  memcpy (kpage, old->kpage, PGSIZE);
 
+  lock_acquire (&frame_lock);
+  list_remove (&page->share_elem);
+  old->refcnt--;
+  if (old->page == page)
+    old->page = list_entry (list_front (&old->sharers), struct page,
+                            share_elem);
+  old->pinned = false;
+  cond_broadcast (&frame_unpinned, &frame_lock);
   lock_release (&frame_lock);
-  return page->kpage;
+  return kpage;
 }
 
-/* Frees a frame entry in frame table.
- * NOTE: don't free the hardware page here because different use cases free
- * in different ways. */
+/* Unpins the frame holding KPAGE, making it a candidate for eviction. */
 void
-ffree (void *kpage)
+frame_unpin (void *kpage)
 {
   lock_acquire (&frame_lock);
   struct frame *frame = get_frame (kpage);
-  if (frame) {
-    list_remove (&frame->elem);
-    free (frame);
+  if (frame)
+  {
+    frame->pinned = false;
+    cond_broadcast (&frame_unpinned, &frame_lock);
   }
   lock_release (&frame_lock);
 }
 
-/* Returns the frame that is pointed to by page. */
-struct frame
-*get_frame (void *kpage)
+/* Chooses a victim in clock order, pins it, and evicts its page without
+ * holding frame_lock. Returns the frame, removed from frame_table and still
+ * pinned, or NULL if no frame could be evicted without waiting. */
+static struct frame *
+evict_one (void)
 {
-  struct list_elem *e;
-  for (e = list_begin (&frame_table); e != list_end (&frame_table);
-      e = list_next (e))
+  bool to_swap;
+  struct frame *frame = evict_begin (&to_swap);
+  if (frame == NULL)
+    return NULL;
+
+  swap_page_t swap_page = SWAP_PAGE_ERROR;
+  if (to_swap)
+  {
+    swap_page = swalloc ();
+    if (swap_page == SWAP_PAGE_ERROR)
+      PANIC ("evict_one: out of swap space");
+    swap_page_write (swap_page, frame->kpage);
+  }
+  evict_end (frame, swap_page);
+  return frame;
+}
+
+/* Chooses a victim in clock order, pins it, and begins evicting its page
+ * with page_evict_begin, which sets *to_swap. Returns the frame, or NULL if
+ * no frame could be evicted without waiting. The eviction must be finished
+ * with evict_end. */
+static struct frame *
+evict_begin (bool *to_swap)
+{
+  size_t tries;
+
+  lock_acquire (&frame_lock);
+  for (tries = list_size (&frame_table); tries > 0; tries--)
   {
-    struct frame *frame = list_entry (e, struct frame, elem);
-    if (frame->kpage == kpage)
+    struct frame *frame = get_frame_to_evict ();
+    if (frame == NULL)
+      break;
+
+    frame->pinned = true;
+    struct page *page = frame->page;
+    lock_release (&frame_lock);
+
+    /* The page cannot be freed while its frame is pinned, so it is safe to
+     * use without frame_lock. Nor can pages attach to or detach from a
+     * pinned shared frame, whose pages are all evicted together. Shared
+     * pages are clean, so they need not be written anywhere. */
+    if (frame->inode != NULL)
+    {
+      if (page_evict_shared (&frame->sharers))
+      {
+        *to_swap = false;
+        return frame;
+      }
+    }
+    else if (page_evict_begin (page, to_swap))
       return frame;
+
+    /* Its owner is busy, likely faulting itself. Stamp the frame as just
+     * used, so that the next pick, in particular the least recently used
+     * fallback of get_frame_to_evict, moves on to another frame. */
+    lock_acquire (&frame_lock);
+    frame->last_used = timer_ticks ();
+    frame->pinned = false;
+    cond_broadcast (&frame_unpinned, &frame_lock);
   }
+  lock_release (&frame_lock);
   return NULL;
 }
 
-/* Get the next frame to evict. Use the "clock" algorithm, which uses timer
- * ticks to estimate LRU. */
+/* Finishes evicting FRAME's page, whose contents were written to swap_page
+ * (see page_evict_end), and removes FRAME from frame_table. FRAME stays
+ * pinned. */
+static void
+evict_end (struct frame *frame, swap_page_t swap_page)
+{
+  if (frame->inode == NULL)
+    page_evict_end (frame->page, swap_page);
+
+  lock_acquire (&frame_lock);
+  if (frame->inode != NULL)
+  {
+    hash_delete (&share_table, &frame->share_elem);
+    frame->inode = NULL;
+  }
+  frame_unlink (frame);
+  lock_release (&frame_lock);
+}
+
+/* Gives FRAME, whose page is KPAGE, to PAGE and adds it pinned to frame_table
+ * just behind the clock hand, so it is examined last. The caller must hold
+ * frame_lock. */
+static void
+frame_install (struct frame *frame, void *kpage, struct page *page)
+{
+  frame->kpage = kpage;
+  frame->page = page;
+  frame->pinned = true;
+  frame->inode = NULL;
+  frame->refcnt = 1;
+  list_init (&frame->sharers);
+  frame->last_used = timer_ticks ();
+  page->kpage = frame->kpage;
+
+  if (clock_hand == NULL)
+    clock_hand = list_end (&frame_table);
+  list_insert (clock_hand, &frame->elem);
+  frames_used++;
+}
+
+/* Removes FRAME from frame_table, keeping the clock hand valid. The caller
+ * must hold frame_lock. */
+static void
+frame_unlink (struct frame *frame)
+{
+  if (clock_hand == &frame->elem)
+    clock_hand = list_next (clock_hand);
+  list_remove (&frame->elem);
+  frame->page = NULL;
+  frames_used--;
+}
+
+/* Keeps between low_water and high_water user frames free by evicting pages
+ * in clock order and returning their frames to the user pool. */
+static void
+pageout_thread (void *aux UNUSED)
+{
+  for (;;)
+  {
+    lock_acquire (&frame_lock);
+    while (frame_cnt - frames_used >= low_water)
+      cond_wait (&pageout_wanted, &frame_lock);
+    lock_release (&frame_lock);
+
+    while (frame_cnt - frames_used < high_water)
+      if (!page_out_one ())
+      {
+        /* Every candidate is pinned or its owner is busy with its own page
+         * table. Let them finish. */
+        timer_sleep (1);
+        break;
+      }
+  }
+}
+
+/* Every FLUSH_INTERVAL ticks, writes each modified mapped-file page in
+ * memory back to its file, like a periodic msync, so that little is left to
+ * write at eviction or munmap time. Each frame is pinned while its page is
+ * written, which keeps it in frame_table for the walk to continue from. */
+static void
+flusher_thread (void *aux UNUSED)
+{
+  for (;;)
+  {
+    timer_sleep (FLUSH_INTERVAL);
+
+    lock_acquire (&frame_lock);
+    struct list_elem *e = list_begin (&frame_table);
+    while (e != list_end (&frame_table))
+    {
+      struct frame *frame = list_entry (e, struct frame, elem);
+      if (frame->pinned || frame->inode != NULL || !frame->page->write_back)
+      {
+        e = list_next (e);
+        continue;
+      }
+
+      frame->pinned = true;
+      lock_release (&frame_lock);
+      page_flush (frame->page);
+      lock_acquire (&frame_lock);
+      frame->pinned = false;
+      cond_broadcast (&frame_unpinned, &frame_lock);
+      e = list_next (e);
+    }
+    lock_release (&frame_lock);
+  }
+}
+
+/* Evicts up to SWAP_CLUSTER pages in clock order and frees their frames.
+ * The victims that must go to swap are written to consecutive swap pages in
+ * one transfer when such a run is free. Returns false if there was nothing
+ * that could be evicted without waiting. */
+static bool
+page_out_one (void)
+{
+  struct frame *victims[SWAP_CLUSTER];
+  void *buffers[SWAP_CLUSTER];
+  swap_page_t swap_pages[SWAP_CLUSTER];
+  bool to_swap;
+  size_t cnt, swap_cnt, i;
+
+  swap_cnt = 0;
+  for (cnt = 0; cnt < SWAP_CLUSTER; cnt++)
+  {
+    if (frame_cnt - frames_used + cnt >= high_water && cnt > 0)
+      break;
+    victims[cnt] = evict_begin (&to_swap);
+    if (victims[cnt] == NULL)
+      break;
+    swap_pages[cnt] = SWAP_PAGE_ERROR;
+    if (to_swap)
+    {
+      swap_pages[cnt] = swap_cnt;
+      buffers[swap_cnt++] = victims[cnt]->kpage;
+    }
+  }
+  if (cnt == 0)
+    return false;
+
+  /* swap_pages[] holds each swapped victim's index into buffers[]; turn it
+   * into a real swap page. */
+  if (swap_cnt > 0)
+  {
+    swap_page_t first = swalloc_multiple (swap_cnt);
+    if (first != SWAP_PAGE_ERROR)
+      swap_pages_write (first, buffers, swap_cnt);
+    for (i = 0; i < cnt; i++)
+      if (swap_pages[i] != SWAP_PAGE_ERROR)
+      {
+        if (first != SWAP_PAGE_ERROR)
+          swap_pages[i] += first;
+        else
+        {
+          swap_pages[i] = swalloc ();
+          if (swap_pages[i] == SWAP_PAGE_ERROR)
+            PANIC ("page_out_one: out of swap space");
+          swap_page_write (swap_pages[i], victims[i]->kpage);
+        }
+      }
+  }
+
+  /* Finish in reverse order, as page_evict_end requires. */
+  for (i = cnt; i > 0; i--)
+  {
+    struct frame *frame = victims[i - 1];
+    evict_end (frame, swap_pages[i - 1]);
+
+    lock_acquire (&frame_lock);
+    frame->pinned = false;
+    cond_broadcast (&frame_unpinned, &frame_lock);
+    lock_release (&frame_lock);
+    palloc_free_page (frame->kpage);
+  }
+  return true;
+}
+
+/* Detaches PAGE from the frame holding it, first waiting for any eviction
+ * in progress on it to finish. Returns true if no page uses the frame any
+ * more, in which case it has been removed from the frame table and the
+ * caller must free PAGE's kpage; false if PAGE had no frame or it is still
+ * shared by other pages.
+ * NOTE: don't free the hardware page here because different use cases free
+ * in different ways. */
+bool
+ffree (struct page *page)
+{
+  bool unused = false;
+
+  lock_acquire (&frame_lock);
+  struct frame *frame = get_frame (page->kpage);
+  while (frame && frame->pinned)
+  {
+    cond_wait (&frame_unpinned, &frame_lock);
+    frame = get_frame (page->kpage);
+  }
+  if (frame && frame->inode != NULL)
+  {
+    list_remove (&page->share_elem);
+    if (--frame->refcnt == 0)
+    {
+      hash_delete (&share_table, &frame->share_elem);
+      frame->inode = NULL;
+      frame_unlink (frame);
+      unused = true;
+    }
+    else if (frame->page == page)
+      frame->page = list_entry (list_front (&frame->sharers), struct page,
+                                share_elem);
+  }
+  else if (frame && frame->page == page)
+  {
+    frame_unlink (frame);
+    unused = true;
+  }
+  lock_release (&frame_lock);
+  return unused;
+}
+
+/* Returns the in-use frame that holds kpage, or NULL if kpage is not a user
+ * frame. */
+static struct frame *
+get_frame (void *kpage)
+{
+  size_t idx = palloc_user_page_idx (kpage);
+  if (idx == SIZE_MAX || frames[idx].page == NULL)
+    return NULL;
+  return &frames[idx];
+}
+
+/* Returns the frame under the clock hand and advances the hand, wrapping
+ * around to the front of frame_table. frame_table must not be empty. */
+static struct frame *
+clock_advance (void)
+{
+  if (clock_hand == NULL || clock_hand == list_end (&frame_table))
+    clock_hand = list_begin (&frame_table);
+  struct frame *frame = list_entry (clock_hand, struct frame, elem);
+  clock_hand = list_next (clock_hand);
+  return frame;
+}
+
+/* Get the next frame to evict with the WSClock algorithm. The hand sweeps
+ * frame_table; a frame whose page was accessed since the last sweep has its
+ * accessed bits cleared, is stamped as used now, and is passed over. The
+ * first unaccessed frame that has gone unused for longer than its owner's
+ * working-set window is the victim, so pages that processes are actively
+ * using are kept, and pages of idle processes, or of processes holding more
+ * than their fault rate shows they need, go first. If every frame is in
+ * some working set, the least recently used unaccessed frame found in a
+ * full sweep is taken instead. Both the upage and kpage accessed bits are
+ * checked, since they are aliased to the same frame. Pinned frames are
+ * skipped. Returns NULL if every frame is pinned. The caller must hold
+ * frame_lock. */
 static struct frame *
 get_frame_to_evict (void)
 {
-  ASSERT (list_size (&frame_table) > 0);
+  size_t size = list_size (&frame_table);
+  int64_t now = timer_ticks ();
+  struct frame *oldest = NULL;
+  size_t step;
 
-  struct list_elem *e = list_begin (&frame_table);
-  struct frame *lru_frame = list_entry (e, struct frame, elem);
-  e = list_next (e);
-  for (; e != list_end (&frame_table); e = list_next (e))
+  for (step = 0; step < 2 * size; step++)
   {
-    struct frame *next_frame = list_entry (e, struct frame, elem);
-    if (next_frame->last_accessed_tick < lru_frame->last_accessed_tick)
-      lru_frame = next_frame;
+    if (oldest != NULL && step >= size)
+      break;
+
+    struct frame *frame = clock_advance ();
+    if (frame->pinned)
+      continue;
+
+    if (frame_accessed (frame))
+    {
+      frame->last_used = now;
+      continue;
+    }
+    if (now - frame->last_used > frame_ws_window (frame))
+      return frame;
+    if (oldest == NULL || frame->last_used < oldest->last_used)
+      oldest = frame;
   }
-  return lru_frame;
+  return oldest;
 }
 
-/* Update frame last accessed tick. Used to approximate a LUR eviction
- * strategy. This function should be called each timer interrupt. */
-void
-frame_tick (void)
+/* Returns the working-set window of FRAME's owner, in timer ticks, or the
+ * largest among its owners if it is shared. The caller must hold
+ * frame_lock. */
+static int64_t
+frame_ws_window (struct frame *frame)
 {
-  int64_t cur_tick = timer_ticks ();
+  unsigned window = 0;
+
+  if (frame->inode == NULL)
+    return frame->page->process ? frame->page->process->ws_window : 0;
+
   struct list_elem *e;
-  for (e = list_begin (&frame_table); e != list_end (&frame_table);
-      e = list_next (e))
+  for (e = list_begin (&frame->sharers); e != list_end (&frame->sharers);
+       e = list_next (e))
   {
-    struct frame *frame = list_entry (e, struct frame, elem);
-    struct page *page = frame->page;
-    uint32_t *pagedir = get_thread (page->tid)->pagedir; 
+    struct page *page = list_entry (e, struct page, share_elem);
+    if (page->process && page->process->ws_window > window)
+      window = page->process->ws_window;
+  }
+  return window;
+}
 
-    if (pagedir_is_accessed (pagedir, page->upage))
+/* Returns true if FRAME was accessed since the last call, through the upage
+ * or kpage alias of any page mapping it, and clears those accessed bits.
+ * Pages whose thread is gone count as unaccessed. The caller must hold
+ * frame_lock. */
+static bool
+frame_accessed (struct frame *frame)
+{
+  struct list_elem *e = NULL;
+  struct page *page = frame->page;
+  bool accessed = false;
+
+  if (frame->inode != NULL)
+  {
+    e = list_begin (&frame->sharers);
+    page = list_entry (e, struct page, share_elem);
+  }
+  for (;;)
+  {
+    struct thread *t = get_thread (page->tid);
+    if (t && t->pagedir)
     {
-      frame->last_accessed_tick = cur_tick;
-      pagedir_set_accessed (get_thread (page->tid)->pagedir, page->upage,
-          false);
+      uint32_t *pagedir = t->pagedir;
+      if (pagedir_is_accessed (pagedir, page->upage) ||
+          pagedir_is_accessed (pagedir, page->kpage))
+        accessed = true;
+      pagedir_set_accessed (pagedir, page->upage, false);
+      pagedir_set_accessed (pagedir, page->kpage, false);
     }
+
+    if (e == NULL || (e = list_next (e)) == list_end (&frame->sharers))
+      break;
+    page = list_entry (e, struct page, share_elem);
   }
+  return accessed;
+}
+
+/* Returns the shared frame holding the data of PAGE, a shareable page in
+ * the filesys, or NULL. The caller must hold frame_lock. */
+static struct frame *
+share_lookup (const struct page *page)
+{
+  struct frame key;
+  struct hash_elem *e;
+
+  key.inode = file_get_inode (page->file);
+  key.ofs = page->ofs;
+  key.read_bytes = page->read_bytes;
+  e = hash_find (&share_table, &key.share_elem);
+  return e != NULL ? hash_entry (e, struct frame, share_elem) : NULL;
+}
+
+/* Returns a hash value for shared frame E. */
+static unsigned
+share_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (e, struct frame, share_elem);
+  return (hash_bytes (&f->inode, sizeof f->inode) ^ hash_int (f->ofs)
+          ^ hash_int (f->read_bytes));
+}
+
+/* Returns true if shared frame A precedes shared frame B. */
+static bool
+share_less (const struct hash_elem *a, const struct hash_elem *b,
+    void *aux UNUSED)
+{
+  const struct frame *fa = hash_entry (a, struct frame, share_elem);
+  const struct frame *fb = hash_entry (b, struct frame, share_elem);
+  if (fa->inode != fb->inode)
+    return fa->inode < fb->inode;
+  if (fa->ofs != fb->ofs)
+    return fa->ofs < fb->ofs;
+  return fa->read_bytes < fb->read_bytes;
 }
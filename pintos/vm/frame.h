@@ -9,7 +9,12 @@ struct page;
 
 void falloc_init (void);
 void *falloc (struct page *page, enum palloc_flags flags);
-void ffree (void *page);
-void frame_tick (void);
+void *falloc_nowait (struct page *page, enum palloc_flags flags);
+void *falloc_shared (struct page *page);
+void frame_share (struct page *page);
+void *frame_unshare (struct page *page);
+bool ffree (struct page *page);
+void frame_unpin (void *kpage);
+void pageout_init (void);
 
 #endif /* threads/frame.h */
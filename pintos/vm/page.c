@@ -1,9 +1,13 @@
 #include "page.h"
+#include <round.h>
+#include "devices/timer.h"
 #include "lib/kernel/hash.h"
 #include "lib/string.h"
 #include "threads/malloc.h"
 #include "threads/vaddr.h"
+#include "userprog/pagedir.h"
 #include "userprog/process.h"
+#include "userprog/syscall.h"
 #include "vm/frame.h"
 
 /* Supplementary paging. Each process has its own supplementary page table
@@ -13,19 +17,60 @@
 /* Maximum number of stack pages. 4kb * 2000 = 8mb */
 #define MAX_STACK_PAGES 2000
 
-struct page;
+/* Fault-around window for file-backed faults, in pages after the faulting
+ * page: a process's first file-backed fault starts it at FAULT_AROUND_INIT,
+ * and it then adapts between 0 and FAULT_AROUND_MAX. */
+#define FAULT_AROUND_INIT 4
+#define FAULT_AROUND_MAX 16
+
+/* Working-set window, in timer ticks: the frame table keeps a process's
+ * pages that were used within its window over older pages (see
+ * get_frame_to_evict). Page-fault frequency adapts the window between
+ * WS_WINDOW_MIN and WS_WINDOW_MAX: faults closer together than
+ * PFF_HIGH_TICKS mean the process's working set does not fit, and double
+ * its window, while faults further apart than PFF_LOW_TICKS mean it holds
+ * more than it needs, and halve it. */
+#define WS_WINDOW_INIT (TIMER_FREQ / 2)
+#define WS_WINDOW_MIN (TIMER_FREQ / 10)
+#define WS_WINDOW_MAX (TIMER_FREQ * 4)
+#define PFF_HIGH_TICKS 2
+#define PFF_LOW_TICKS (TIMER_FREQ / 4)
 
-/* Lock to ensure only one thread is accessing the supplemental page table at
- * a time. */
-/* TODO: Lock should be per process instead of system-wide. */
-struct lock page_lock;
+/* Most neighbouring pages read in on each side of a swap fault. */
+#define SWAP_READ_AROUND (SWAP_CLUSTER / 2)
+
+struct page;
 
 static bool load_page_from_filesys (struct page *page);
+static bool read_page_from_file (struct page *page);
+static size_t fault_around_update (const void *upage);
+static struct page *filesys_neighbor (const struct page *page, size_t k);
 static bool load_page_from_swap (struct page *page);
+static bool load_page_from_fill (struct page *page);
 static void page_add_spage_table (struct page *page);
 static bool page_frame_alloc (struct page *page);
+static bool page_frame_alloc_nowait (struct page *page);
+static bool page_frame_alloc_file (struct page *page, bool nowait,
+    bool *loaded);
+static void page_frame_release (struct page *page);
+static struct page *swap_neighbor (const void *upage, swap_page_t swap_page);
 static bool install_page (void *upage, void *kpage, bool writable);
+static bool page_maps_writable (const struct page *page);
+static struct page *file_page_create (void *upage, struct file *file,
+    off_t ofs, uint32_t read_bytes, uint32_t zero_bytes, bool writable);
+static void page_write_back (struct page *page, uint32_t *pagedir);
+static bool filesys_lock_begin (bool wait, bool *release);
+static void filesys_lock_end (bool release);
+static struct region *region_lookup (const void *uaddr);
+static struct page *region_page_create (const void *uaddr);
+static bool range_has_pages (const void *start, size_t page_cnt);
 static void internal_page_free (struct page *page);
+static void page_mark_loaded (struct page *page);
+static void spage_lock (void);
+static void spage_unlock (void);
+static struct vmstat *current_vmstat (void);
+static void count_resident (struct page *page, bool resident);
+static void working_set_update (void);
 
 /* Returns a hash value for page p. */
 unsigned
@@ -49,13 +94,18 @@ page_less (const struct hash_elem *a_, const struct hash_elem *b_,
 void
 page_destructor (struct hash_elem *hash_elem, void *aux UNUSED)
 {
-  lock_acquire (&page_lock);
+  spage_lock ();
   struct page *page = hash_entry (hash_elem, struct page, hash_elem);
   {
     switch (page->present)
     {
       case PRESENT_MEMORY:
-        ffree (page->kpage);
+        /* Unmap the page, so that pagedir_destroy leaves its frame alone
+         * if it is still shared with another process. */
+        pagedir_clear_page (thread_current ()->pagedir, page->upage);
+        if (ffree (page))
+          palloc_free_page (page->kpage);
+        count_resident (page, false);
         break;
       case PRESENT_SWAP:
         swfree (page->swap_page);
@@ -65,15 +115,78 @@ page_destructor (struct hash_elem *hash_elem, void *aux UNUSED)
     }
     free (page);
   }
-  lock_release (&page_lock);
+  spage_unlock ();
+}
+
+/* Acquires the current process's supplemental page table lock. Each process
+ * has its own, so independent processes fault in parallel. Kernel threads
+ * have no supplemental page table, so this does nothing for them. */
+static void
+spage_lock (void)
+{
+  struct process *p = thread_current ()->process;
+  if (p)
+    lock_acquire (&p->spage_lock);
+}
+
+/* Releases the current process's supplemental page table lock. */
+static void
+spage_unlock (void)
+{
+  struct process *p = thread_current ()->process;
+  if (p)
+    lock_release (&p->spage_lock);
+}
+
+/* Returns the current process's paging statistics. The caller must hold
+ * its spage_lock. */
+static struct vmstat *
+current_vmstat (void)
+{
+  return &thread_current ()->process->vmstat;
 }
 
-/* Init supplemental page table. NOTE: Individual supplemental page tables are
- * init on process creation. */
+/* Counts page as having become resident in its process if resident, or as
+ * having stopped being resident otherwise. The caller must hold the
+ * process's spage_lock. */
+static void
+count_resident (struct page *page, bool resident)
+{
+  struct vmstat *s = &page->process->vmstat;
+  if (!resident)
+    s->rss--;
+  else if (++s->rss > s->max_rss)
+    s->max_rss = s->rss;
+}
+
+/* Adjusts the current process's working-set window for a fault that brings
+ * a page in, according to how long it has been since the previous one. The
+ * caller must hold its spage_lock. */
+static void
+working_set_update (void)
+{
+  struct process *p = thread_current ()->process;
+  int64_t now = timer_ticks ();
+  int64_t interval = now - p->last_fault_tick;
+
+  if (p->ws_window == 0)
+    p->ws_window = WS_WINDOW_INIT;
+  else if (interval < PFF_HIGH_TICKS)
+    p->ws_window = p->ws_window * 2 < WS_WINDOW_MAX ? p->ws_window * 2
+                                                    : WS_WINDOW_MAX;
+  else if (interval > PFF_LOW_TICKS)
+    p->ws_window = p->ws_window / 2 > WS_WINDOW_MIN ? p->ws_window / 2
+                                                    : WS_WINDOW_MIN;
+  p->last_fault_tick = now;
+}
+
+/* Copies the current process's paging statistics into stats. */
 void
-spage_init (void)
+page_get_vmstat (struct vmstat *stats)
 {
-  lock_init (&page_lock);
+  spage_lock ();
+  *stats = *current_vmstat ();
+  spage_unlock ();
 }
 
 /* Looks up page with user virtual address uaddr. */
@@ -95,13 +208,13 @@ page_lookup (const void *uaddr)
 }
 
 /* Checks if there is a supplemental page entry for user virtual address
-uaddr. */
+uaddr, or a region that would create one on first touch. */
 bool
 page_exists (const void *uaddr)
 {
-  lock_acquire (&page_lock);
-  bool exists = page_lookup (uaddr);
-  lock_release (&page_lock);
+  spage_lock ();
+  bool exists = page_lookup (uaddr) || region_lookup (uaddr);
+  spage_unlock ();
   return exists;
 }
 
@@ -111,89 +224,313 @@ page_exists (const void *uaddr)
 bool
 is_unallocated_stack_access (const void* fault_addr)
 {
-  lock_acquire (&page_lock);
   void *esp = thread_current ()->esp;
   bool result = fault_addr < get_stack_bottom() && fault_addr >= esp - PUSHA_BYTES
 		&& fault_addr >= MIN_STACK_ADDRESS; 
-  lock_release (&page_lock);
   return result;
 }
 
-/* Allocates a new page under the bottom of the stack of the current thread. 
- * Return the allocated pages upage. */
-void *
-stack_page_alloc (void) 
+/* Adds a page just under the bottom of the stack of the current thread and
+ * moves the bottom past it. The page is demand-zero: it is left in
+ * PRESENT_FILL with a zero fill and gets a frame only when it is first
+ * touched. Returns the page, or NULL if out of memory. The caller must hold
+ * spage_lock. */
+static struct page *
+stack_page_reserve (void)
 {
-  lock_acquire (&page_lock);
   struct page *page = malloc (sizeof (struct page));
-  void *kpage = NULL;
   if (page)
   {
     page->upage = get_stack_bottom () - PGSIZE;
-    page->present = PRESENT_MEMORY;
+    page->kpage = NULL;
+    page->file = NULL;
+    page->shareable = false;
+    page->write_back = false;
+    page->process = thread_current ()->process;
+    page->present = PRESENT_FILL;
+    page->fill = 0;
+    page->dirty_bit = false;
     page->writable = true;
     page->tid = thread_current ()->tid;
     page_add_spage_table (page);
+    ++thread_current ()->stack_pages;
+  }
+  return page;
+}
 
-    if (page_frame_alloc (page))
-      ++thread_current ()->stack_pages; 
-    else
-      page_free (page);
+/* Gives page, a reserved stack page, a zeroed frame. Returns true if
+ * successful. The caller must hold spage_lock. */
+static bool
+stack_page_load (struct page *page)
+{
+  ASSERT (page->present == PRESENT_FILL);
+
+  if (!page_frame_alloc (page))
+    return false;
+  page_mark_loaded (page);
+  return true;
+}
 
-    kpage = page->upage;
+/* Allocates a new page under the bottom of the stack of the current thread. 
+ * Return the allocated pages upage. */
+void *
+stack_page_alloc (void) 
+{
+  spage_lock ();
+  struct page *page = stack_page_reserve ();
+  void *upage = NULL;
+  if (page)
+  {
+    if (stack_page_load (page))
+      upage = page->upage;
+    else
+    {
+      internal_page_free (page);
+      --thread_current ()->stack_pages;
+    }
   }
-  lock_release (&page_lock);
-  return kpage;
+  spage_unlock ();
+  return upage;
 }
 
-/* Allocates pages under the stack until user virtual address uaddr is loaded 
- * into a frame. */
+/* Grows the stack of the current thread down to user virtual address uaddr
+ * and loads the page containing it into a frame. The pages skipped over
+ * between the old bottom and that page are only reserved, and are
+ * zero-filled on demand like any other PRESENT_FILL page, so a large stack
+ * frame costs frames only for the pages it touches. Returns the upage of the
+ * loaded page, or NULL on failure. */
 void *
 stack_page_alloc_multiple (void *uaddr)
 {
   ASSERT (uaddr < PHYS_BASE && uaddr >= MIN_STACK_ADDRESS);
 
-  void *stack_bottom = get_stack_bottom ();
-  while (uaddr < stack_bottom)
-  {
-    if (!stack_page_alloc ())
-      return NULL;
-    stack_bottom = get_stack_bottom ();
-  }
-  return stack_bottom;
+  spage_lock ();
+  current_vmstat ()->stack_faults++;
+  current_vmstat ()->minor_faults++;
+  working_set_update ();
+
+  struct page *page = NULL;
+  void *upage = NULL;
+  bool success = true;
+  while (success && uaddr < get_stack_bottom ())
+    success = (page = stack_page_reserve ()) != NULL;
+  if (success && page && stack_page_load (page))
+    upage = page->upage;
+  spage_unlock ();
+  return upage;
 }
 
 /* Frees a page with base user virtual address uaddr. */
 void
 page_free (void *uaddr)
 {
-  lock_acquire (&page_lock);
+  spage_lock ();
   struct page *page = page_lookup (uaddr);
   if (page)
     internal_page_free (page);
-  lock_release (&page_lock);
+  spage_unlock ();
 }
 
 /* Lazy load a segment from executable file. The file metadata will be
-stored into the process supplemental page table. */
+stored into the process supplemental page table. The file data never
+changes, so processes share one frame for it: read-only pages for good,
+writable ones until they are first written (copy on write). */
 void
 lazy_load_segment (void *uaddr, struct file *file, off_t ofs,
 										uint32_t read_bytes, uint32_t zero_bytes, bool writable)
 {
-  lock_acquire (&page_lock);
+  spage_lock ();
+  /* Open a new file instance because the original may close. */
+  struct file *reopened = file_reopen (file);
+  struct page *page = file_page_create (uaddr, reopened, ofs, read_bytes,
+                                        zero_bytes, writable);
+  if (page)
+    page->shareable = true;
+  else
+    file_close (reopened);
+  spage_unlock ();
+}  
+
+/* Creates a region of the current process mapping length bytes at ofs in
+ * file to user virtual address start, which must be page-aligned. No pages
+ * are created until they are touched, so this takes the same time however
+ * large the region is. Returns the region, or NULL if it would overlap an
+ * existing page or region, or if out of memory. */
+struct region *
+region_create (void *start, struct file *file, off_t ofs, size_t length,
+               bool writable)
+{
+  ASSERT (pg_ofs (start) == 0);
+
+  struct process *p = thread_current ()->process;
+  size_t page_cnt = DIV_ROUND_UP (length, PGSIZE);
+  if (p == NULL || length == 0 || !is_user_vaddr (start))
+    return NULL;
+
+  /* The last page must stay below PHYS_BASE. */
+  size_t user_pages = (PHYS_BASE - start) / PGSIZE;
+  if (page_cnt > user_pages)
+    return NULL;
+
+  spage_lock ();
+  struct region *region = NULL;
+  struct list_elem *e;
+  for (e = list_begin (&p->regions); e != list_end (&p->regions);
+       e = list_next (e))
+  {
+    struct region *r = list_entry (e, struct region, elem);
+    if (start < r->start + ROUND_UP (r->length, PGSIZE)
+        && r->start < start + page_cnt * PGSIZE)
+      goto done;
+  }
+  if (range_has_pages (start, page_cnt))
+    goto done;
+
+  region = malloc (sizeof *region);
+  if (region == NULL)
+    goto done;
+  region->file = file_reopen (file);
+  if (region->file == NULL)
+  {
+    free (region);
+    region = NULL;
+    goto done;
+  }
+  region->start = start;
+  region->length = length;
+  region->ofs = ofs;
+  region->writable = writable;
+  list_push_back (&p->regions, &region->elem);
+
+ done:
+  spage_unlock ();
+  return region;
+}
+
+/* Removes region from the current process, writing its modified pages back
+ * to its file and freeing them. */
+void
+region_destroy (struct region *region)
+{
+  bool release;
+  filesys_lock_begin (true, &release);
+  spage_lock ();
+  void *end = region->start + region->length;
+  for (void *upage = region->start; upage < end; upage += PGSIZE)
+  {
+    struct page *page = page_lookup (upage);
+    if (page == NULL)
+      continue;
+    if (page->present == PRESENT_MEMORY)
+      page_write_back (page, thread_current ()->pagedir);
+    internal_page_free (page);
+  }
+  list_remove (&region->elem);
+  spage_unlock ();
+
+  file_close (region->file);
+  filesys_lock_end (release);
+  free (region);
+}
+
+/* Returns the current process's region containing uaddr, or NULL. */
+static struct region *
+region_lookup (const void *uaddr)
+{
+  struct process *p = thread_current ()->process;
+  if (p == NULL)
+    return NULL;
+
+  struct list_elem *e;
+  for (e = list_begin (&p->regions); e != list_end (&p->regions);
+       e = list_next (e))
+  {
+    struct region *r = list_entry (e, struct region, elem);
+    if (uaddr >= r->start
+        && uaddr < r->start + ROUND_UP (r->length, PGSIZE))
+      return r;
+  }
+  return NULL;
+}
+
+/* Creates the page containing uaddr in the current process's region that
+ * covers it, which must not have that page yet. The page uses the region's
+ * file, which outlives it, rather than a file of its own. Returns the page,
+ * or NULL if no region covers uaddr or if out of memory. */
+static struct page *
+region_page_create (const void *uaddr)
+{
+  struct region *r = region_lookup (uaddr);
+  if (r == NULL)
+    return NULL;
+
+  void *upage = pg_round_down (uaddr);
+  size_t page_ofs = upage - r->start;
+  size_t read_bytes = r->length - page_ofs < PGSIZE ? r->length - page_ofs
+                                                    : PGSIZE;
+  struct page *page = file_page_create (upage, r->file, r->ofs + page_ofs,
+                                        read_bytes, PGSIZE - read_bytes,
+                                        r->writable);
+  if (page)
+    page->write_back = true;
+  return page;
+}
+
+/* Returns true if the current process has a page in the page_cnt pages
+ * starting at start. Looks up each of those pages or walks the whole
+ * supplemental page table, whichever is fewer. */
+static bool
+range_has_pages (const void *start, size_t page_cnt)
+{
+  struct hash *table = &thread_current ()->process->spage_table;
+  const void *end = start + page_cnt * PGSIZE;
+
+  if (page_cnt <= hash_size (table))
+  {
+    for (const void *upage = start; upage < end; upage += PGSIZE)
+      if (page_lookup (upage))
+        return true;
+    return false;
+  }
+
+  struct hash_iterator i;
+  hash_first (&i, table);
+  while (hash_next (&i))
+  {
+    struct page *page = hash_entry (hash_cur (&i), struct page, hash_elem);
+    if (page->upage >= start && page->upage < end)
+      return true;
+  }
+  return false;
+}
+
+/* Creates a page in the filesys and adds it to the current process's
+ * supplemental page table. The page takes over file, which
+ * internal_page_free closes, unless the page belongs to a region. Returns
+ * the page, or NULL if out of memory. */
+static struct page *
+file_page_create (void *uaddr, struct file *file, off_t ofs,
+                  uint32_t read_bytes, uint32_t zero_bytes, bool writable)
+{
   struct page *page = malloc (sizeof (struct page));
+  if (page == NULL)
+    return NULL;
   page->present = PRESENT_FILESYS;
   page->upage = uaddr;
+  page->kpage = NULL;
+  page->process = thread_current ()->process;
   page->writable = writable;
+  page->dirty_bit = false;
+  page->shareable = false;
+  page->write_back = false;
   page->tid = thread_current ()->tid;
-  /* Open a new file instance because the original may close. */
-  page->file = file_reopen (file);
+  page->file = file;
   page->ofs = ofs;
   page->read_bytes = read_bytes;
   page->zero_bytes = zero_bytes;
   page_add_spage_table (page);
-  lock_release (&page_lock);
-}  
+  return page;
+}
 
 /* Looks up the page containing user virtual address upage, and calls the helper
 function corresponding to where the page is located. Returns true if the page
@@ -201,11 +538,14 @@ is successfully loaded, false otherwise. */
 bool
 load_page_into_frame (const void *uaddr)
 {
-  lock_acquire (&page_lock);
+  spage_lock ();
 	struct page *page = page_lookup (uaddr);
+  if (!page)
+    page = region_page_create (uaddr);
   bool result = false;
 	if (page)
 	{
+    working_set_update ();
 		switch (page->present)
 		{
 			case PRESENT_FILESYS:
@@ -213,39 +553,158 @@ load_page_into_frame (const void *uaddr)
         break;
 			case PRESENT_SWAP:
         result = load_page_from_swap (page);
+        break;
+			case PRESENT_FILL:
+        result = load_page_from_fill (page);
         break;
 			default:
 				break;
 		}
 	}
-  lock_release (&page_lock);
+  spage_unlock ();
 	return result;
 }
 
-/* Loads page from the filesys into a frame. Returns true if successful. */
+/* Gives the current process's page containing user virtual address uaddr,
+ * which is mapped read-only because it is copy-on-write, a frame of its own
+ * and maps it writable. The page may have been evicted since the fault, in
+ * which case there is nothing to do: the write faults again as not present
+ * and loads the page. Returns false if there is no such page or it is not
+ * writable at all, in which case the fault is a real rights violation. */
+bool
+page_write_fault (const void *uaddr)
+{
+  spage_lock ();
+  struct page *page = page_lookup (uaddr);
+  bool result = page && page->writable;
+  if (result && page->present == PRESENT_MEMORY)
+  {
+    void *kpage = frame_unshare (page);
+    uint32_t *pd = thread_current ()->pagedir;
+    pagedir_clear_page (pd, page->upage);
+    result = pagedir_set_page (pd, page->upage, kpage, true);
+    page->dirty_bit = true;
+    frame_unpin (kpage);
+    current_vmstat ()->cow_faults++;
+    current_vmstat ()->minor_faults++;
+  }
+  spage_unlock ();
+  return result;
+}
+
+/* Loads page from the filesys into a frame. Returns true if successful.
+ *
+ * Fault-around: the file-backed pages that follow page in the same file are
+ * also loaded, as far as the process's fault-around window reaches and as
+ * long as free frames are available for them without evicting anything. */
 static bool
 load_page_from_filesys (struct page *page)
 {
   ASSERT (page->present == PRESENT_FILESYS);
 
   /* Get a page of memory and add it to the process's address space. */
-  if (!page_frame_alloc (page))
+  bool loaded;
+  if (!page_frame_alloc_file (page, false, &loaded))
     return false;
 
   /* Load this page. */
-	file_seek (page->file, page->ofs);
-  if (file_read (page->file, page->kpage, page->read_bytes) != (int) page->read_bytes)
+  if (!loaded && !read_page_from_file (page))
   {
+    frame_unpin (page->kpage);
     internal_page_free (page);
     return false; 
   }
-  memset (page->kpage + page->read_bytes, 0, page->zero_bytes);
+  page_mark_loaded (page);
+  current_vmstat ()->filesys_faults++;
+  if (loaded)
+    current_vmstat ()->minor_faults++;
+  else
+    current_vmstat ()->major_faults++;
 
-  page->present = PRESENT_MEMORY;
+  size_t window = fault_around_update (page->upage);
+  for (size_t k = 1; k <= window; ++k)
+  {
+    struct page *n = filesys_neighbor (page, k);
+    if (n == NULL || !page_frame_alloc_file (n, true, &loaded))
+      break;
+    if (!loaded && !read_page_from_file (n))
+    {
+      page_frame_release (n);
+      break;
+    }
+    page_mark_loaded (n);
+  }
   return true;
 }
 
-/* Loads page from swap into a frame. Returns true if successful. */
+/* Reads page's contents from its file into its frame. Returns true if
+ * successful. A shareable page's frame is then offered for sharing with
+ * other processes running the same executable. */
+static bool
+read_page_from_file (struct page *page)
+{
+  /* Read at an offset: a region's pages all use the region's file. */
+  if (file_read_at (page->file, page->kpage, page->read_bytes, page->ofs)
+      != (int) page->read_bytes)
+    return false;
+  memset (page->kpage + page->read_bytes, 0, page->zero_bytes);
+  if (page->shareable)
+    frame_share (page);
+  return true;
+}
+
+/* Updates the current process's fault-around window for a fault on the
+ * file-backed page at upage, and returns the new window. A fault just past
+ * the pages the previous fault mapped means sequential access, and doubles
+ * the window; any other fault halves it, so random access soon turns
+ * fault-around off. */
+static size_t
+fault_around_update (const void *upage)
+{
+  struct process *p = thread_current ()->process;
+  if (p == NULL)
+    return 0;
+
+  if (p->last_file_fault == NULL)
+    p->fault_around = FAULT_AROUND_INIT;
+  else if (upage > p->last_file_fault
+           && (size_t) (upage - p->last_file_fault)
+              <= (p->fault_around + 1) * PGSIZE)
+  {
+    p->fault_around = p->fault_around == 0 ? 1 : p->fault_around * 2;
+    if (p->fault_around > FAULT_AROUND_MAX)
+      p->fault_around = FAULT_AROUND_MAX;
+  }
+  else
+    p->fault_around /= 2;
+  p->last_file_fault = (void *) upage;
+  return p->fault_around;
+}
+
+/* Returns the current process's page k pages after page if it is still in
+ * the filesys and holds the data k pages further into the same file,
+ * otherwise NULL. The next pages of a region are created as needed. */
+static struct page *
+filesys_neighbor (const struct page *page, size_t k)
+{
+  const void *upage = page->upage + k * PGSIZE;
+  if (!is_user_vaddr (upage))
+    return NULL;
+  struct page *n = page_lookup (upage);
+  if (n == NULL && page->write_back)
+    n = region_page_create (upage);
+  if (n && n->present == PRESENT_FILESYS
+      && file_get_inode (n->file) == file_get_inode (page->file)
+      && n->ofs == page->ofs + (off_t) (k * PGSIZE))
+    return n;
+  return NULL;
+}
+
+/* Loads page from swap into a frame. Returns true if successful.
+ *
+ * Neighbouring virtual pages that sit in neighbouring swap pages, as happens
+ * when they were evicted together, are read in by the same transfer, as long
+ * as free frames are available for them without evicting anything. */
 static bool
 load_page_from_swap (struct page *page)
 {
@@ -254,10 +713,328 @@ load_page_from_swap (struct page *page)
   if (!page_frame_alloc (page))
     return false;
 
-  swap_page_read (page->swap_page, page->kpage);
-  swfree (page->swap_page);
+  /* Gather neighbours outward from page, stopping on each side at the first
+   * one that is not in the matching swap page or cannot get a frame. */
+  struct page *before[SWAP_READ_AROUND], *after[SWAP_READ_AROUND - 1];
+  size_t before_cnt = 0, after_cnt = 0;
+  struct page *n;
+  while (before_cnt < SWAP_READ_AROUND
+         && (n = swap_neighbor (page->upage - (before_cnt + 1) * PGSIZE,
+                                page->swap_page - (before_cnt + 1))) != NULL
+         && page_frame_alloc_nowait (n))
+    before[before_cnt++] = n;
+  while (after_cnt < SWAP_READ_AROUND - 1
+         && (n = swap_neighbor (page->upage + (after_cnt + 1) * PGSIZE,
+                                page->swap_page + (after_cnt + 1))) != NULL
+         && page_frame_alloc_nowait (n))
+    after[after_cnt++] = n;
+
+  /* Read the whole run in swap order. */
+  struct page *cluster[SWAP_CLUSTER];
+  void *buffers[SWAP_CLUSTER];
+  size_t cnt = 0, i;
+  for (i = before_cnt; i > 0; --i)
+    cluster[cnt++] = before[i - 1];
+  cluster[cnt++] = page;
+  for (i = 0; i < after_cnt; ++i)
+    cluster[cnt++] = after[i];
+  for (i = 0; i < cnt; ++i)
+    buffers[i] = cluster[i]->kpage;
+  swap_pages_read (cluster[0]->swap_page, buffers, cnt);
+
+  for (i = 0; i < cnt; ++i)
+  {
+    swfree (cluster[i]->swap_page);
+    page_mark_loaded (cluster[i]);
+  }
+  current_vmstat ()->swap_faults++;
+  current_vmstat ()->major_faults++;
+  current_vmstat ()->swap_ins += cnt;
+  return true;
+}
+
+/* Loads page, which is filled with one repeated word, into a frame by
+ * filling the frame. Returns true if successful. */
+static bool
+load_page_from_fill (struct page *page)
+{
+  ASSERT (page->present == PRESENT_FILL);
+
+  if (!page_frame_alloc (page))
+    return false;
+
+  /* The frame is already zeroed. */
+  if (page->fill != 0)
+  {
+    uint32_t *words = page->kpage;
+    for (size_t i = 0; i < PGSIZE / sizeof *words; ++i)
+      words[i] = page->fill;
+  }
+
+  page_mark_loaded (page);
+  current_vmstat ()->fill_faults++;
+  current_vmstat ()->minor_faults++;
+  return true;
+}
 
+/* Returns the current process's page at upage if it is in swap at
+ * swap_page, otherwise NULL. */
+static struct page *
+swap_neighbor (const void *upage, swap_page_t swap_page)
+{
+  if (!is_user_vaddr (upage) || swap_page < 0)
+    return NULL;
+  struct page *p = page_lookup (upage);
+  if (p && p->present == PRESENT_SWAP && p->swap_page == swap_page)
+    return p;
+  return NULL;
+}
+
+/* Records that page's contents are now in its frame, and unpins the frame so
+ * it may be evicted. The kernel alias was dirtied by the load itself, so its
+ * dirty bit is cleared: afterward only changes made through either alias mark
+ * the page dirty. */
+static void
+page_mark_loaded (struct page *page)
+{
+  pagedir_set_dirty (thread_current ()->pagedir, page->kpage, false);
   page->present = PRESENT_MEMORY;
+  count_resident (page, true);
+  frame_unpin (page->kpage);
+}
+
+/* Begins evicting page, which must be in memory, from its frame: unmaps it
+ * from its process and sets *to_swap to whether its contents must be written
+ * to swap before page_evict_end, rather than read back from its file later.
+ * The frame itself is left to the caller. The page's supplemental page table
+ * stays locked until then, so its process waits in the page fault handler if
+ * it touches the page. Eviction is split this way so that several pages can
+ * be written to swap in one transfer. Returns false without doing anything
+ * if page's supplemental page table, or for a mapped-file page the file
+ * system, is in use by another thread, since waiting for it could
+ * deadlock. */
+bool
+page_evict_begin (struct page *page, bool *to_swap)
+{
+  ASSERT (page->present == PRESENT_MEMORY);
+
+  /* The page belongs to some process, not necessarily the current one. */
+  struct lock *lock = page->process ? &page->process->spage_lock : NULL;
+  bool locked = lock && !lock_held_by_current_thread (lock);
+  if (locked && !lock_try_acquire (lock))
+    return false;
+  page->evict_unlock = locked;
+
+  bool release = false;
+  if (page->write_back && !filesys_lock_begin (false, &release))
+  {
+    if (locked)
+      lock_release (lock);
+    return false;
+  }
+
+  /* Unmap the page before checking whether it is dirty, so that its
+   * process, which may still be running, faults instead of changing it
+   * between the check and the write-out. The dirty bit survives the unmap.
+   * Check both the upage and kpage dirty bits, since they are both aliased
+   * to the same frame. */
+  struct thread *t = get_thread (page->tid);
+  bool dirty = true;
+  if (t && t->pagedir)
+  {
+    pagedir_clear_page (t->pagedir, page->upage);
+    dirty = (pagedir_is_dirty (t->pagedir, page->upage) ||
+             pagedir_is_dirty (t->pagedir, page->kpage));
+  }
+
+  /* A mapped-file page goes back to its file, and only if it changed. */
+  if (page->write_back)
+  {
+    if (dirty)
+      file_write_at (page->file, page->kpage, page->read_bytes, page->ofs);
+    filesys_lock_end (release);
+    *to_swap = false;
+    return true;
+  }
+
+  /* If page is unmodified and comes from a file, evict the page to
+   * filesys. Otherwise evict to swap, unless it is filled with one repeated
+   * word, in which case recording the word is enough. */
+  page->dirty_bit |= dirty;
+  *to_swap = page->dirty_bit || !page->file;
+  if (*to_swap && page_is_same_filled (page->kpage, &page->fill))
+    *to_swap = false;
+  return true;
+}
+
+/* Evicts pages, the list of clean shareable pages, linked by
+ * share_elem, that share one pinned frame: unmaps each from its process and
+ * leaves it to be read back from its file. The frame itself is left to the
+ * caller. Returns false without doing anything if any of the pages'
+ * supplemental page tables is in use by another thread, since waiting for
+ * it could deadlock. */
+bool
+page_evict_shared (struct list *pages)
+{
+  struct list_elem *e, *f;
+  struct page *page;
+
+  /* Lock every owner first, so that the pages go all at once or not at
+   * all. */
+  for (e = list_begin (pages); e != list_end (pages); e = list_next (e))
+  {
+    page = list_entry (e, struct page, share_elem);
+    struct lock *lock = page->process ? &page->process->spage_lock : NULL;
+    page->evict_unlock = lock && !lock_held_by_current_thread (lock);
+    if (page->evict_unlock && !lock_try_acquire (lock))
+    {
+      page->evict_unlock = false;
+      for (f = list_begin (pages); f != e; f = list_next (f))
+      {
+        page = list_entry (f, struct page, share_elem);
+        if (page->evict_unlock)
+          lock_release (&page->process->spage_lock);
+      }
+      return false;
+    }
+  }
+
+  for (e = list_begin (pages); e != list_end (pages); e = list_next (e))
+  {
+    page = list_entry (e, struct page, share_elem);
+    ASSERT (page->present == PRESENT_MEMORY && !page->dirty_bit);
+    struct thread *t = get_thread (page->tid);
+    if (t && t->pagedir)
+      pagedir_clear_page (t->pagedir, page->upage);
+    page->present = PRESENT_FILESYS;
+    page->kpage = NULL;
+    count_resident (page, false);
+    page->process->vmstat.evictions++;
+  }
+
+  for (e = list_begin (pages); e != list_end (pages); e = list_next (e))
+  {
+    page = list_entry (e, struct page, share_elem);
+    if (page->evict_unlock)
+      lock_release (&page->process->spage_lock);
+  }
+  return true;
+}
+
+/* Writes page, a mapped-file page in memory whose frame is pinned, back to
+ * its file if it was modified since it was loaded or last written back.
+ * Called periodically for every such page, so that modified mapped data
+ * reaches the file without waiting for eviction or munmap. Returns false
+ * without doing anything if page's supplemental page table is in use by
+ * another thread, since waiting for it could deadlock. */
+bool
+page_flush (struct page *page)
+{
+  ASSERT (page->write_back);
+
+  struct lock *lock = page->process ? &page->process->spage_lock : NULL;
+  if (lock && !lock_try_acquire (lock))
+    return false;
+  bool release;
+  if (!filesys_lock_begin (false, &release))
+  {
+    if (lock)
+      lock_release (lock);
+    return false;
+  }
+  struct thread *t = get_thread (page->tid);
+  if (page->present == PRESENT_MEMORY && t && t->pagedir)
+    page_write_back (page, t->pagedir);
+  filesys_lock_end (release);
+  if (lock)
+    lock_release (lock);
+  return true;
+}
+
+/* Writes page, a mapped-file page in memory, back to its file if it was
+ * modified, according to the dirty bits of its upage in pagedir and its
+ * kpage, and clears those bits. The caller must keep page from being
+ * evicted meanwhile, and must hold filesys_syscall_lock. */
+static void
+page_write_back (struct page *page, uint32_t *pagedir)
+{
+  if (pagedir_is_dirty (pagedir, page->upage) ||
+      pagedir_is_dirty (pagedir, page->kpage))
+  {
+    /* Clear first, so that a write racing with ours is caught next time. */
+    pagedir_set_dirty (pagedir, page->upage, false);
+    pagedir_set_dirty (pagedir, page->kpage, false);
+    file_write_at (page->file, page->kpage, page->read_bytes, page->ofs);
+  }
+}
+
+/* Takes filesys_syscall_lock for writing a mapped-file page back, unless
+ * the current thread already holds it because it faulted or unmapped inside
+ * a file system call. Mapped files are written from the pageout and flusher
+ * threads and from other processes' faults, not only from munmap, and
+ * must not race with file system calls on the same inode. Sets *release to
+ * whether filesys_lock_end must release the lock. If wait is false, fails
+ * instead of waiting, and returns false: a thread that holds another
+ * process's spage_lock must not wait, since the lock's holder may be faulting
+ * in that process. */
+static bool
+filesys_lock_begin (bool wait, bool *release)
+{
+  *release = false;
+  if (lock_held_by_current_thread (&filesys_syscall_lock))
+    return true;
+  if (wait)
+    lock_acquire (&filesys_syscall_lock);
+  else if (!lock_try_acquire (&filesys_syscall_lock))
+    return false;
+  *release = true;
+  return true;
+}
+
+/* Releases filesys_syscall_lock if filesys_lock_begin took it, as told by
+ * release. */
+static void
+filesys_lock_end (bool release)
+{
+  if (release)
+    lock_release (&filesys_syscall_lock);
+}
+
+/* Finishes evicting page, begun with page_evict_begin. swap_page is where
+ * its contents were written, or SWAP_PAGE_ERROR if it was not written
+ * because it can be read back from its file or is same-filled. When a
+ * thread has begun evicting several pages, it must finish them in the
+ * reverse order, since the first page begun for each process holds that
+ * process's lock. */
+void
+page_evict_end (struct page *page, swap_page_t swap_page)
+{
+  if (swap_page == SWAP_PAGE_ERROR)
+    page->present = page->dirty_bit || !page->file ? PRESENT_FILL
+                                                   : PRESENT_FILESYS;
+  else
+  {
+    page->present = PRESENT_SWAP;
+    page->swap_page = swap_page;
+  }
+  page->kpage = NULL;
+  count_resident (page, false);
+  page->process->vmstat.evictions++;
+
+  if (page->evict_unlock)
+    lock_release (&page->process->spage_lock);
+}
+
+/* Returns true and sets *fill if the page at kpage consists of one 32-bit
+ * word repeated, as zeroed stack and BSS pages do. */
+bool
+page_is_same_filled (const void *kpage, uint32_t *fill)
+{
+  const uint32_t *words = kpage;
+  for (size_t i = 1; i < PGSIZE / sizeof *words; ++i)
+    if (words[i] != words[0])
+      return false;
+  *fill = words[0];
   return true;
 }
 
@@ -270,13 +1047,85 @@ page_add_spage_table (struct page *page)
 		hash_insert (&p->spage_table, &page->hash_elem);	
 }
 
-/* Allocates a frame for page. Return true if successful, false otherwise. */
+/* Allocates a frame for page and maps it. Return true if successful, false
+ * otherwise. On success the frame is pinned until the caller unpins it. */
 static bool
 page_frame_alloc (struct page *page)
 {
   page->upage = pg_round_down (page->upage);
   void *kpage = falloc (page, PAL_USER | PAL_ZERO); 
-  return kpage && install_page (page->upage, kpage, page->writable);
+  if (!kpage)
+    return false;
+  if (!install_page (page->upage, kpage, page_maps_writable (page)))
+  {
+    page_frame_release (page);
+    return false;
+  }
+  return true;
+}
+
+/* Like page_frame_alloc, but fails instead of evicting another page if no
+ * frame is free. */
+static bool
+page_frame_alloc_nowait (struct page *page)
+{
+  void *kpage = falloc_nowait (page, PAL_USER);
+  if (!kpage)
+    return false;
+  if (!install_page (page->upage, kpage, page_maps_writable (page)))
+  {
+    page_frame_release (page);
+    return false;
+  }
+  return true;
+}
+
+/* Undoes page_frame_alloc_nowait for page, whose frame is still pinned,
+ * leaving page where it was before. */
+static void
+page_frame_release (struct page *page)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  if (pagedir_get_page (pd, page->upage) == page->kpage)
+    pagedir_clear_page (pd, page->upage);
+  frame_unpin (page->kpage);
+  if (ffree (page))
+    palloc_free_page (page->kpage);
+  page->kpage = NULL;
+}
+
+/* Allocates a frame for page, which is in the filesys, and maps it, like
+ * page_frame_alloc or, if nowait, page_frame_alloc_nowait. A shareable page
+ * instead shares the frame of another process that already holds the same
+ * data, if there is one. Sets *loaded to whether the frame already holds
+ * page's data. */
+static bool
+page_frame_alloc_file (struct page *page, bool nowait, bool *loaded)
+{
+  *loaded = false;
+  if (page->shareable)
+  {
+    void *kpage = falloc_shared (page);
+    if (kpage != NULL)
+    {
+      *loaded = true;
+      if (install_page (page->upage, kpage, false))
+        return true;
+      page_frame_release (page);
+      return false;
+    }
+  }
+  return nowait ? page_frame_alloc_nowait (page) : page_frame_alloc (page);
+}
+
+/* Returns whether page, which is being loaded, is mapped writable. A
+ * shareable page loaded from its file is mapped read-only even if it is
+ * writable, so that its first write faults into page_write_fault. */
+static bool
+page_maps_writable (const struct page *page)
+{
+  return page->writable
+         && !(page->shareable && page->present == PRESENT_FILESYS);
 }
 
 /* Adds a mapping from user virtual address UPAGE to kernel
@@ -308,9 +1157,16 @@ internal_page_free (struct page *page)
   {
     pagedir_clear_page (thread_current ()->pagedir, page->upage);
     if (page->present == PRESENT_MEMORY)
+      count_resident (page, false);
+
+    /* Wait out any eviction in progress before freeing the frame, which
+     * stays in use if other processes share it. */
+    if (ffree (page))
       palloc_free_page (page->kpage);
-    ffree (page->kpage);
-    file_close (page->file);
+    else if (page->kpage == NULL && page->present == PRESENT_SWAP)
+      swfree (page->swap_page);
+    if (!page->write_back)
+      file_close (page->file);
     hash_delete (&p->spage_table, &page->hash_elem);
     free (page);
   }
@@ -1,6 +1,7 @@
 #ifndef VM_PAGE_H
 #define VM_PAGE_H
 
+#include <vmstat.h>
 #include "filesys/file.h"
 #include "lib/kernel/hash.h"
 #include "vm/swap.h"
@@ -9,30 +10,53 @@
 enum page_present {
   PRESENT_MEMORY,
   PRESENT_FILESYS,
-  PRESENT_SWAP
+  PRESENT_SWAP,
+  PRESENT_FILL    /* Every word is fill; stored nowhere. */
 };
 
 /* Page metadata to be stored in the supplemental page table. */
 struct page {
   void *upage;  /* User virtual address. */
   void *kpage;  /* Kernel virtual address. */
-  struct process *process;
+  struct process *process;  /* Owner, whose spage_lock guards this page. */
   enum page_present present;
   bool writable;
   int tid;
-  bool dirty_bit;
+  bool dirty_bit;   /* Written since loaded, so its file is out of date. */
   int access_time;
   struct hash_elem hash_elem;
+  struct list_elem share_elem;  /* Element in a shared frame's sharers. */
 
   /* Page is in file system */
   struct file *file;
   off_t ofs;
   uint32_t read_bytes;
 	uint32_t zero_bytes;
+  bool shareable;   /* Loaded into frames shared with other processes. */
+  bool write_back;  /* Mapped file: changes go back to the file, not swap. */
 
   /* Page is in swap. */
   /* swap_page_t swap_page; */
   int swap_page;
+
+  /* Page is filled with one repeated word. */
+  uint32_t fill;
+
+  /* Set while being evicted if page_evict_end must release the owner's
+   * spage_lock. */
+  bool evict_unlock;
+};
+
+/* A region of a process's address space, such as a memory-mapped file,
+ * described as a whole: its pages get a struct page only when first
+ * touched. Pages are written back to the file rather than to swap. */
+struct region {
+  void *start;          /* First page. */
+  size_t length;        /* Bytes of file data mapped from start. */
+  struct file *file;    /* Own instance of the mapped file. */
+  off_t ofs;            /* Offset in file of start. */
+  bool writable;
+  struct list_elem elem;  /* Element in the process's regions. */
 };
 
 unsigned page_hash (const struct hash_elem *p_, void *aux);
@@ -40,7 +64,6 @@ bool page_less (const struct hash_elem *a_, const struct hash_elem *b_,
     void *aux);
 void page_destructor (struct hash_elem *hash_elem, void *aux);
 
-void spage_init (void);
 bool page_exists (const void *vaddr);
 bool is_unallocated_stack_access (const void *fault_addr);
 void *stack_page_alloc (void);
@@ -48,6 +71,16 @@ void *stack_page_alloc_multiple (void *vaddr);
 void page_free (void *vaddr);
 void lazy_load_segment (void *vaddr, struct file *file, off_t ofs,
 	uint32_t read_bytes, uint32_t zero_bytes, bool writable);
+struct region *region_create (void *start, struct file *file, off_t ofs,
+	size_t length, bool writable);
+void region_destroy (struct region *region);
 bool load_page_into_frame (const void *vaddr);
+bool page_write_fault (const void *vaddr);
+void page_get_vmstat (struct vmstat *stats);
+bool page_evict_begin (struct page *page, bool *to_swap);
+bool page_evict_shared (struct list *pages);
+bool page_flush (struct page *page);
+void page_evict_end (struct page *page, swap_page_t swap_page);
+bool page_is_same_filled (const void *kpage, uint32_t *fill);
 
 #endif /* vm/page.h */
@@ -1,63 +1,79 @@
 #include "vm/swap.h"
 
+#include <bitmap.h>
+#include <debug.h>
 #include "devices/block.h"
-#include "lib/kernel/list.h"
 #include "threads/malloc.h"
 #include "threads/vaddr.h"
-
-/* Invalid swap page. */
-#define SWAP_PAGE_ERROR -1
+#include "vm/zswap.h"
 
 /* Number of sectors in each page. Assumes page size is greater than sector
  * size. */
 #define PG_NUM_SECTORS PGSIZE / BLOCK_SECTOR_SIZE 
 
 struct block *swap_block;
-struct swap_slot *swap_table;
 int swap_num_pages;
 
+/* One bit per swap page, true if in use. */
+static struct bitmap *swap_map;
+
+/* Next-fit cursor: the search for a free swap page starts here, just past
+ * the last page handed out, so consecutive evictions land in adjacent
+ * pages and go to disk as sequential writes. */
+static size_t swap_cursor;
+
 /* Lock so that multiple threads cannot alloc/free swap at the same time. */
 struct lock swap_lock;
 
-struct swap_slot
-{
-  bool free;
-  block_sector_t block_sector;
-};
-
 /* Initialize the swap table. */
 void
 swalloc_init (void)
 {
   swap_block = block_get_role (BLOCK_SWAP);
   swap_num_pages = block_size (swap_block) * BLOCK_SECTOR_SIZE / PGSIZE;
-  // TODO: static alloc instead of malloc
-  swap_table = malloc (swap_num_pages * sizeof (struct swap_slot));
-
-  for (swap_page_t i = 0; i < swap_num_pages; ++i)
-  {
-    struct swap_slot *swap_slot = swap_table + i;
-    swap_slot->free = true;
-  }
+  swap_map = bitmap_create (swap_num_pages);
+  if (swap_map == NULL)
+    PANIC ("swalloc_init: out of memory for %d swap pages", swap_num_pages);
+  swap_cursor = 0;
 
   lock_init (&swap_lock);
+  zswap_init ();
 }
 
-/* Allocate a page in swap. Return the swap page in which the page starts on. */
+/* Allocate a page in swap. Return the swap page in which the page starts on,
+ * or SWAP_PAGE_ERROR if swap is full. */
 swap_page_t
 swalloc (void)
 {
   lock_acquire (&swap_lock);
+  size_t idx = bitmap_scan_and_flip (swap_map, swap_cursor, 1, false);
+  if (idx == BITMAP_ERROR && swap_cursor > 0)
+    idx = bitmap_scan_and_flip (swap_map, 0, 1, false);
+  swap_page_t swap_page = SWAP_PAGE_ERROR;
+  if (idx != BITMAP_ERROR)
+  {
+    swap_page = idx;
+    swap_cursor = idx + 1 < (size_t) swap_num_pages ? idx + 1 : 0;
+  }
+  lock_release (&swap_lock);
+  return swap_page;
+}
+
+/* Allocates cnt consecutive pages in swap, so that they can be written or
+ * read in one transfer. Returns the first, or SWAP_PAGE_ERROR if there is no
+ * free run that long. */
+swap_page_t
+swalloc_multiple (size_t cnt)
+{
+  lock_acquire (&swap_lock);
+  size_t idx = bitmap_scan_and_flip (swap_map, swap_cursor, cnt, false);
+  if (idx == BITMAP_ERROR && swap_cursor > 0)
+    idx = bitmap_scan_and_flip (swap_map, 0, cnt, false);
   swap_page_t swap_page = SWAP_PAGE_ERROR;
-  for (swap_page_t i = 0; i < swap_num_pages; ++i)
+  if (idx != BITMAP_ERROR)
   {
-    struct swap_slot *swap_slot = swap_table + i;
-    if (swap_slot->free)
-    {
-      swap_slot->free = false;
-      swap_page = i;
-      break;
-    }
+    swap_page = idx;
+    swap_cursor = idx + cnt < (size_t) swap_num_pages ? idx + cnt : 0;
   }
   lock_release (&swap_lock);
   return swap_page;
@@ -67,39 +83,82 @@ swalloc (void)
 void
 swfree (swap_page_t swap_page)
 {
+  zswap_invalidate (swap_page);
   lock_acquire (&swap_lock);
-  struct swap_slot *swap_slot = swap_table + swap_page;
-  swap_slot->free = true;
+  ASSERT (bitmap_test (swap_map, swap_page));
+  bitmap_reset (swap_map, swap_page);
   lock_release (&swap_lock);
 }
 
-/* Reads page at swap_page into buffer. */
+/* Reads page at swap_page into buffer, from the compressed cache if it is
+ * there. */
 void
 swap_page_read (swap_page_t swap_page, void *buffer)
 {
-  int sector_ofs = 0;
-  int page_ofs = 0;
-  int base_sector = swap_page * PG_NUM_SECTORS;
-  while (sector_ofs < PG_NUM_SECTORS)
-  {
-    block_read (swap_block, base_sector + sector_ofs, buffer + page_ofs);
-    ++sector_ofs;
-    page_ofs += BLOCK_SECTOR_SIZE;
-  }
+  if (!zswap_load (swap_page, buffer))
+    block_read_multiple (swap_block, swap_page * PG_NUM_SECTORS,
+        PG_NUM_SECTORS, buffer);
 }
 
-/* Writes buffer into page at swap_page. */
+/* Writes buffer into page at swap_page, or into the compressed cache if it
+ * takes it. */
 void
 swap_page_write (swap_page_t swap_page, const void *buffer)
 {
-  int sector_ofs = 0;
-  int page_ofs = 0;
-  int base_sector = swap_page * PG_NUM_SECTORS;
-  while (sector_ofs < PG_NUM_SECTORS)
-  {
-    block_write (swap_block, base_sector + sector_ofs, buffer + page_ofs);
-    ++sector_ofs;
-    page_ofs += BLOCK_SECTOR_SIZE;
-  }
+  if (!zswap_store (swap_page, buffer))
+    swap_page_writeback (swap_page, buffer);
+}
+
+/* Writes buffer into page at swap_page on the swap device, bypassing the
+ * compressed cache. */
+void
+swap_page_writeback (swap_page_t swap_page, const void *buffer)
+{
+  block_write_multiple (swap_block, swap_page * PG_NUM_SECTORS,
+      PG_NUM_SECTORS, buffer);
+}
+
+/* Appends a block_iovec for swap page swap_page, with buffer as its buffer,
+ * to iov, which holds *cnt entries. */
+static void
+swap_iovec_add (struct block_iovec iov[], size_t *cnt, swap_page_t swap_page,
+    void *buffer)
+{
+  ASSERT (*cnt < SWAP_CLUSTER);
+  iov[*cnt].sector = swap_page * PG_NUM_SECTORS;
+  iov[*cnt].cnt = PG_NUM_SECTORS;
+  iov[*cnt].buffer = buffer;
+  ++*cnt;
 }
 
+/* Reads the cnt consecutive swap pages starting at first into buffers, one
+ * page per buffer. Pages held by the compressed cache are taken from it and
+ * the rest are read from disk in a single transfer. */
+void
+swap_pages_read (swap_page_t first, void *const buffers[], size_t cnt)
+{
+  struct block_iovec iov[SWAP_CLUSTER];
+  size_t iov_cnt = 0;
+  ASSERT (cnt <= SWAP_CLUSTER);
+  for (size_t i = 0; i < cnt; ++i)
+    if (!zswap_load (first + i, buffers[i]))
+      swap_iovec_add (iov, &iov_cnt, first + i, buffers[i]);
+  if (iov_cnt > 0)
+    block_readv (swap_block, iov, iov_cnt);
+}
+
+/* Writes buffers, one page each, to the cnt consecutive swap pages starting
+ * at first. Pages the compressed cache takes stay in memory and the rest go
+ * to disk in a single transfer. */
+void
+swap_pages_write (swap_page_t first, void *const buffers[], size_t cnt)
+{
+  struct block_iovec iov[SWAP_CLUSTER];
+  size_t iov_cnt = 0;
+  ASSERT (cnt <= SWAP_CLUSTER);
+  for (size_t i = 0; i < cnt; ++i)
+    if (!zswap_store (first + i, buffers[i]))
+      swap_iovec_add (iov, &iov_cnt, first + i, buffers[i]);
+  if (iov_cnt > 0)
+    block_writev (swap_block, iov, iov_cnt);
+}
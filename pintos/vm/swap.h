@@ -1,13 +1,28 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include "lib/stddef.h"
 #include "lib/stdint.h"
 
 /* Represents which page sequentially in swap. */
 typedef int32_t swap_page_t;
 
+/* Invalid swap page. */
+#define SWAP_PAGE_ERROR -1
+
+/* Most pages moved to or from swap in one clustered transfer. */
+#define SWAP_CLUSTER 8
+
 void swalloc_init (void);
 
 swap_page_t swalloc (void);
+swap_page_t swalloc_multiple (size_t cnt);
 void swfree (swap_page_t swap_page);
 
 void swap_page_read (swap_page_t swap_page, void *buffer);
 void swap_page_write (swap_page_t swap_page, const void *buffer);
+void swap_page_writeback (swap_page_t swap_page, const void *buffer);
+void swap_pages_read (swap_page_t first, void *const buffers[], size_t cnt);
+void swap_pages_write (swap_page_t first, void *const buffers[], size_t cnt);
 
+#endif /* vm/swap.h */
@@ -0,0 +1,396 @@
+#include "vm/zswap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+/* Pages of kernel pool set aside for compressed data. If that much
+ * contiguous memory is not free at boot, smaller arenas are tried, down to
+ * ZSWAP_MIN_PAGES, below which the cache is disabled. */
+#define ZSWAP_ARENA_PAGES 64
+#define ZSWAP_MIN_PAGES 8
+
+/* Compressed data is stored in runs of chunks of this many bytes. */
+#define CHUNK_SIZE 64
+
+/* A page that does not compress to at most this many bytes goes to disk. */
+#define MAX_COMPRESSED (PGSIZE - PGSIZE / 4)
+
+/* Compressed format parameters. The data is a sequence of groups, each a
+ * control byte followed by eight items, one per control bit from the least
+ * significant: a 0 bit is a literal byte, a 1 bit is a two-byte copy of
+ * MIN_MATCH to MAX_MATCH earlier bytes from up to MAX_OFFSET bytes back. */
+#define MIN_MATCH 3
+#define MAX_MATCH (MIN_MATCH + 15)
+#define MAX_OFFSET 4095
+#define HASH_BITS 12
+
+/* A page held in the cache. */
+struct zswap_entry
+  {
+    struct hash_elem hash_elem; /* Element in entries. */
+    struct list_elem lru_elem;  /* Element in lru. */
+    swap_page_t swap_page;      /* Swap page it was assigned. */
+    size_t chunk;               /* First chunk in arena, if LEN > 0. */
+    size_t len;                 /* Compressed length, 0 if same-filled. */
+    uint32_t fill;              /* Repeated word, if LEN == 0. */
+  };
+
+static uint8_t *arena;          /* Compressed data. */
+static size_t arena_pages;      /* Size of arena in pages. */
+static struct bitmap *arena_map;  /* One bit per chunk, true if in use. */
+static struct hash entries;     /* Cached pages, by swap page. */
+static struct list lru;         /* Cached pages, oldest first. */
+
+/* Guards everything above and the scratch buffers below. Held across the
+ * disk writes made to free up arena space. */
+static struct lock zswap_lock;
+
+/* Scratch space. */
+static uint8_t compress_buf[MAX_COMPRESSED];
+static uint8_t writeback_buf[PGSIZE];
+static uint16_t match_table[1 << HASH_BITS];
+
+/* Statistics. */
+static unsigned long long stored_cnt;       /* Pages compressed. */
+static unsigned long long same_filled_cnt;  /* Pages of one repeated word. */
+static unsigned long long rejected_cnt;     /* Pages sent to disk. */
+static unsigned long long writeback_cnt;    /* Pages written back. */
+static unsigned long long load_cnt;         /* Pages loaded from cache. */
+
+static unsigned entry_hash (const struct hash_elem *, void *aux);
+static bool entry_less (const struct hash_elem *, const struct hash_elem *,
+                        void *aux);
+static struct zswap_entry *entry_lookup (swap_page_t);
+static void entry_remove (struct zswap_entry *);
+static void writeback_oldest (void);
+static size_t lz_compress (const uint8_t *src, uint8_t *dst, size_t dst_max);
+static bool lz_decompress (const uint8_t *src, size_t src_len, uint8_t *dst);
+static void entry_decompress (const struct zswap_entry *, void *page);
+
+/* Sets up the cache. Called from swalloc_init. */
+void
+zswap_init (void)
+{
+  lock_init (&zswap_lock);
+  hash_init (&entries, entry_hash, entry_less, NULL);
+  list_init (&lru);
+
+  for (arena_pages = ZSWAP_ARENA_PAGES; arena_pages >= ZSWAP_MIN_PAGES;
+       arena_pages /= 2)
+    {
+      arena = palloc_get_multiple (0, arena_pages);
+      if (arena != NULL)
+        break;
+    }
+  if (arena != NULL)
+    {
+      arena_map = bitmap_create (arena_pages * PGSIZE / CHUNK_SIZE);
+      if (arena_map == NULL)
+        {
+          palloc_free_multiple (arena, arena_pages);
+          arena = NULL;
+        }
+    }
+  if (arena == NULL)
+    printf ("zswap: no memory for arena, compressed swap disabled\n");
+}
+
+/* Offers page, which is about to be written to swap_page, to the cache.
+ * Returns true if the cache took it, in which case it must not be written
+ * to disk; false if it must be written to disk as usual. */
+bool
+zswap_store (swap_page_t swap_page, const void *page)
+{
+  struct zswap_entry *e;
+  size_t chunk = 0, len = 0;
+  uint32_t fill = 0;
+
+  if (arena == NULL)
+    return false;
+
+  lock_acquire (&zswap_lock);
+  e = entry_lookup (swap_page);
+  if (e != NULL)
+    entry_remove (e);
+
+  if (!page_is_same_filled (page, &fill))
+    {
+      len = lz_compress (page, compress_buf, MAX_COMPRESSED);
+      if (len == 0)
+        {
+          rejected_cnt++;
+          lock_release (&zswap_lock);
+          return false;
+        }
+
+      /* Make room by writing back the oldest pages if necessary. */
+      size_t chunk_cnt = DIV_ROUND_UP (len, CHUNK_SIZE);
+      while ((chunk = bitmap_scan_and_flip (arena_map, 0, chunk_cnt, false))
+             == BITMAP_ERROR && !list_empty (&lru))
+        writeback_oldest ();
+      if (chunk == BITMAP_ERROR)
+        {
+          rejected_cnt++;
+          lock_release (&zswap_lock);
+          return false;
+        }
+      memcpy (arena + chunk * CHUNK_SIZE, compress_buf, len);
+    }
+
+  e = malloc (sizeof *e);
+  if (e == NULL)
+    {
+      if (len > 0)
+        bitmap_set_multiple (arena_map, chunk, DIV_ROUND_UP (len, CHUNK_SIZE),
+                             false);
+      lock_release (&zswap_lock);
+      return false;
+    }
+  e->swap_page = swap_page;
+  e->chunk = chunk;
+  e->len = len;
+  e->fill = fill;
+  hash_insert (&entries, &e->hash_elem);
+  list_push_back (&lru, &e->lru_elem);
+  if (len > 0)
+    stored_cnt++;
+  else
+    same_filled_cnt++;
+
+  lock_release (&zswap_lock);
+  return true;
+}
+
+/* If swap_page is in the cache, copies its contents into page, drops it
+ * from the cache, and returns true. Otherwise returns false, and the page
+ * must be read from disk. */
+bool
+zswap_load (swap_page_t swap_page, void *page)
+{
+  struct zswap_entry *e;
+
+  if (arena == NULL)
+    return false;
+
+  lock_acquire (&zswap_lock);
+  e = entry_lookup (swap_page);
+  if (e != NULL)
+    {
+      entry_decompress (e, page);
+      entry_remove (e);
+      load_cnt++;
+    }
+  lock_release (&zswap_lock);
+  return e != NULL;
+}
+
+/* Drops swap_page from the cache, if present, because it has been freed. */
+void
+zswap_invalidate (swap_page_t swap_page)
+{
+  struct zswap_entry *e;
+
+  if (arena == NULL)
+    return;
+
+  lock_acquire (&zswap_lock);
+  e = entry_lookup (swap_page);
+  if (e != NULL)
+    entry_remove (e);
+  lock_release (&zswap_lock);
+}
+
+/* Prints cache statistics. */
+void
+zswap_print_stats (void)
+{
+  if (arena != NULL)
+    printf ("zswap: %llu compressed, %llu same-filled, %llu rejected, "
+            "%llu written back, %llu loaded\n",
+            stored_cnt, same_filled_cnt, rejected_cnt, writeback_cnt,
+            load_cnt);
+}
+
+/* Returns a hash value for entry E. */
+static unsigned
+entry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct zswap_entry, hash_elem)->swap_page);
+}
+
+/* Returns true if entry A precedes entry B. */
+static bool
+entry_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct zswap_entry, hash_elem)->swap_page
+          < hash_entry (b, struct zswap_entry, hash_elem)->swap_page);
+}
+
+/* Returns the entry for swap_page, or NULL. */
+static struct zswap_entry *
+entry_lookup (swap_page_t swap_page)
+{
+  struct zswap_entry key;
+  struct hash_elem *e;
+
+  key.swap_page = swap_page;
+  e = hash_find (&entries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct zswap_entry, hash_elem) : NULL;
+}
+
+/* Removes E from the cache, freeing its arena space. */
+static void
+entry_remove (struct zswap_entry *e)
+{
+  hash_delete (&entries, &e->hash_elem);
+  list_remove (&e->lru_elem);
+  if (e->len > 0)
+    bitmap_set_multiple (arena_map, e->chunk, DIV_ROUND_UP (e->len, CHUNK_SIZE),
+                         false);
+  free (e);
+}
+
+/* Writes the oldest cached page back to its swap page on disk and drops it
+ * from the cache. */
+static void
+writeback_oldest (void)
+{
+  struct zswap_entry *e = list_entry (list_front (&lru), struct zswap_entry,
+                                      lru_elem);
+  entry_decompress (e, writeback_buf);
+  swap_page_writeback (e->swap_page, writeback_buf);
+  entry_remove (e);
+  writeback_cnt++;
+}
+
+/* Copies the page held by E into page. */
+static void
+entry_decompress (const struct zswap_entry *e, void *page)
+{
+  if (e->len == 0)
+    {
+      uint32_t *words = page;
+      size_t i;
+
+      for (i = 0; i < PGSIZE / sizeof *words; i++)
+        words[i] = e->fill;
+    }
+  else if (!lz_decompress (arena + e->chunk * CHUNK_SIZE, e->len, page))
+    PANIC ("zswap: corrupt data for swap page %d", (int) e->swap_page);
+}
+
+/* Returns a hash of the MIN_MATCH bytes at P. */
+static inline unsigned
+hash3 (const uint8_t *p)
+{
+  unsigned v = p[0] | (p[1] << 8) | (p[2] << 16);
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Compresses the page at src into dst. Returns the compressed length, or 0
+ * if it would exceed dst_max bytes. */
+static size_t
+lz_compress (const uint8_t *src, uint8_t *dst, size_t dst_max)
+{
+  size_t ip = 0, op = 0, ctrl = 0;
+  int bit = 8;
+
+  memset (match_table, 0, sizeof match_table);
+  while (ip < PGSIZE)
+    {
+      size_t len = 0, ofs = 0;
+
+      if (bit == 8)
+        {
+          if (op >= dst_max)
+            return 0;
+          ctrl = op++;
+          dst[ctrl] = 0;
+          bit = 0;
+        }
+
+      /* match_table holds 1 + the last position with each hash. */
+      if (ip + MIN_MATCH <= PGSIZE)
+        {
+          unsigned h = hash3 (src + ip);
+          size_t cand = match_table[h];
+          match_table[h] = ip + 1;
+          if (cand != 0 && ip - (cand - 1) <= MAX_OFFSET)
+            {
+              cand--;
+              ofs = ip - cand;
+              while (len < MAX_MATCH && ip + len < PGSIZE
+                     && src[cand + len] == src[ip + len])
+                len++;
+            }
+        }
+
+      if (len >= MIN_MATCH)
+        {
+          if (op + 2 > dst_max)
+            return 0;
+          dst[ctrl] |= 1 << bit;
+          dst[op++] = ((len - MIN_MATCH) << 4) | (ofs >> 8);
+          dst[op++] = ofs & 0xff;
+          ip += len;
+        }
+      else
+        {
+          if (op + 1 > dst_max)
+            return 0;
+          dst[op++] = src[ip++];
+        }
+      bit++;
+    }
+  return op;
+}
+
+/* Decompresses the src_len bytes at src into the page at dst. Returns false
+ * if src is not valid compressed data for a whole page. */
+static bool
+lz_decompress (const uint8_t *src, size_t src_len, uint8_t *dst)
+{
+  size_t ip = 0, op = 0;
+
+  while (op < PGSIZE)
+    {
+      uint8_t ctrl;
+      int bit;
+
+      if (ip >= src_len)
+        return false;
+      ctrl = src[ip++];
+      for (bit = 0; bit < 8 && op < PGSIZE; bit++)
+        if (ctrl & (1 << bit))
+          {
+            size_t len, ofs;
+
+            if (ip + 2 > src_len)
+              return false;
+            len = (src[ip] >> 4) + MIN_MATCH;
+            ofs = ((src[ip] & 0xf) << 8) | src[ip + 1];
+            ip += 2;
+            if (ofs == 0 || ofs > op || op + len > PGSIZE)
+              return false;
+            for (; len > 0; len--, op++)
+              dst[op] = dst[op - ofs];
+          }
+        else
+          {
+            if (ip >= src_len)
+              return false;
+            dst[op++] = src[ip++];
+          }
+    }
+  return true;
+}
@@ -0,0 +1,23 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include "vm/swap.h"
+
+/* Compressed swap cache.
+ *
+ * Pages written to swap are first offered to an in-memory arena in the
+ * kernel pool, keyed by the swap page they were assigned. A page that
+ * compresses well, or that is filled with a single repeated word, stays
+ * there instead of going to the swap device. When the arena fills, the least
+ * recently stored pages are written back to their swap pages on disk to make
+ * room. swap.c consults the cache on every swap read and write, so the rest
+ * of the VM code is unaware of it. */
+
+void zswap_init (void);
+bool zswap_store (swap_page_t, const void *page);
+bool zswap_load (swap_page_t, void *page);
+void zswap_invalidate (swap_page_t);
+void zswap_print_stats (void);
+
+#endif /* vm/zswap.h */